@@ -0,0 +1,310 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "arducamdemosaic.h"
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define ARDUCAM_DEMOSAIC_NEON
+#endif
+
+// NOTE(marcin.sielski): Interpolated lines, V averages the lines above and
+// below, H the left and right neighbours, X the diagonal neighbours and C
+// the four direct neighbours of every pixel.
+enum
+{
+  LINE_V,
+  LINE_H,
+  LINE_X,
+  LINE_C,
+  LINES
+};
+
+typedef struct
+{
+  ArduCamDemosaic *demosaic;
+  guint index;
+  guint8 *scratch;
+  guint scratch_width;
+}
+ArduCamDemosaicBand;
+
+struct _ArduCamDemosaic
+{
+  GThreadPool *pool;
+  guint threads;
+  ArduCamDemosaicBand *bands;
+  GMutex lock;
+  GCond cond;
+  guint pending;
+  guint active;
+
+  const guint8 *src;
+  gsize src_stride;
+  guint8 *dst;
+  gsize dst_stride;
+  guint width;
+  guint height;
+  ArduCamDemosaicFormat format;
+};
+
+static void
+arducam_demosaic_avg (const guint8 * a, const guint8 * b, guint8 * dst, 
+    guint n)
+{
+  guint i = 0;
+
+#if defined(__SSE2__)
+  for (; i + 16 <= n; i += 16)
+  {
+    _mm_storeu_si128 ((__m128i *) (dst + i), 
+      _mm_avg_epu8 (_mm_loadu_si128 ((const __m128i *) (a + i)), 
+        _mm_loadu_si128 ((const __m128i *) (b + i))));
+  }
+#elif defined(ARDUCAM_DEMOSAIC_NEON)
+  for (; i + 16 <= n; i += 16)
+  {
+    vst1q_u8 (dst + i, vrhaddq_u8 (vld1q_u8 (a + i), vld1q_u8 (b + i)));
+  }
+#endif
+  for (; i < n; i++) dst[i] = (a[i] + b[i] + 1) >> 1;
+}
+
+// NOTE(marcin.sielski): Average of the neighbours on both sides, mirrored at
+// the edges which keeps the colour of the missing neighbour
+static void
+arducam_demosaic_avg_sides (const guint8 * line, guint8 * dst, guint n)
+{
+  arducam_demosaic_avg (line, line + 2, dst + 1, n - 2);
+  dst[0] = line[1];
+  dst[n - 1] = line[n - 2];
+}
+
+static inline guint8
+arducam_demosaic_luma (guint r, guint g, guint b)
+{
+  return (77 * r + 150 * g + 29 * b + 128) >> 8;
+}
+
+// NOTE(marcin.sielski): Picks the colour planes for even and odd columns
+static void
+arducam_demosaic_compose (guint8 * out, guint n, 
+    const guint8 * const even[3], const guint8 * const odd[3], 
+    ArduCamDemosaicFormat format)
+{
+  guint i = 0;
+
+#ifdef ARDUCAM_DEMOSAIC_NEON
+  for (; i + 32 <= n; i += 32)
+  {
+    uint8x16x2_t rgb[3];
+    for (guint c = 0; c < 3; c++)
+    {
+      rgb[c] = vzipq_u8 (vld2q_u8 (even[c] + i).val[0], 
+        vld2q_u8 (odd[c] + i).val[1]);
+    }
+    for (guint h = 0; h < 2; h++)
+    {
+      if (format == ARDUCAM_DEMOSAIC_RGB)
+      {
+        uint8x16x3_t px = { { rgb[0].val[h], rgb[1].val[h], rgb[2].val[h] } };
+        vst3q_u8 (out + 3 * (i + 16 * h), px);
+      }
+      else
+      {
+        uint16x8_t lo = vmull_u8 (vget_low_u8 (rgb[0].val[h]), vdup_n_u8 (77));
+        uint16x8_t hi = vmull_u8 (vget_high_u8 (rgb[0].val[h]), vdup_n_u8 (77));
+        lo = vmlal_u8 (lo, vget_low_u8 (rgb[1].val[h]), vdup_n_u8 (150));
+        hi = vmlal_u8 (hi, vget_high_u8 (rgb[1].val[h]), vdup_n_u8 (150));
+        lo = vmlal_u8 (lo, vget_low_u8 (rgb[2].val[h]), vdup_n_u8 (29));
+        hi = vmlal_u8 (hi, vget_high_u8 (rgb[2].val[h]), vdup_n_u8 (29));
+        vst1q_u8 (out + i + 16 * h, 
+          vcombine_u8 (vrshrn_n_u16 (lo, 8), vrshrn_n_u16 (hi, 8)));
+      }
+    }
+  }
+#endif
+  if (format == ARDUCAM_DEMOSAIC_RGB)
+  {
+    for (; i < n; i++)
+    {
+      const guint8 * const *plane = (i & 1) ? odd : even;
+      out[3 * i] = plane[0][i];
+      out[3 * i + 1] = plane[1][i];
+      out[3 * i + 2] = plane[2][i];
+    }
+  }
+  else
+  {
+    for (; i < n; i++)
+    {
+      const guint8 * const *plane = (i & 1) ? odd : even;
+      out[i] = arducam_demosaic_luma (plane[0][i], plane[1][i], plane[2][i]);
+    }
+  }
+}
+
+static void
+arducam_demosaic_band (ArduCamDemosaicBand * band)
+{
+  ArduCamDemosaic *demosaic = band->demosaic;
+  guint width = demosaic->width;
+  guint height = demosaic->height;
+  guint y0 = height * band->index / demosaic->active;
+  guint y1 = height * (band->index + 1) / demosaic->active;
+
+  if (band->scratch_width < width)
+  {
+    band->scratch = g_realloc (band->scratch, LINES * width);
+    band->scratch_width = width;
+  }
+  guint8 *v = band->scratch + LINE_V * width;
+  guint8 *h = band->scratch + LINE_H * width;
+  guint8 *x = band->scratch + LINE_X * width;
+  guint8 *c = band->scratch + LINE_C * width;
+
+  for (guint y = y0; y < y1; y++)
+  {
+    const guint8 *line = demosaic->src + y * demosaic->src_stride;
+    const guint8 *up = y > 0 ? line - demosaic->src_stride : 
+      line + demosaic->src_stride;
+    const guint8 *down = y + 1 < height ? line + demosaic->src_stride : 
+      line - demosaic->src_stride;
+
+    arducam_demosaic_avg (up, down, v, width);
+    arducam_demosaic_avg_sides (line, h, width);
+    arducam_demosaic_avg_sides (v, x, width);
+    arducam_demosaic_avg (h, v, c, width);
+
+    // NOTE(marcin.sielski): BGGR, even lines are B G B G, odd lines G R G R
+    guint8 *out = demosaic->dst + y * demosaic->dst_stride;
+    if (!(y & 1))
+    {
+      const guint8 * const even[3] = { x, c, line };
+      const guint8 * const odd[3] = { v, line, h };
+      arducam_demosaic_compose (out, width, even, odd, demosaic->format);
+    }
+    else
+    {
+      const guint8 * const even[3] = { h, line, v };
+      const guint8 * const odd[3] = { line, c, x };
+      arducam_demosaic_compose (out, width, even, odd, demosaic->format);
+    }
+  }
+}
+
+static void
+arducam_demosaic_worker (gpointer data, gpointer user_data)
+{
+  ArduCamDemosaicBand *band = data;
+  ArduCamDemosaic *demosaic = user_data;
+
+  arducam_demosaic_band (band);
+
+  g_mutex_lock (&demosaic->lock);
+  if (!--demosaic->pending) g_cond_signal (&demosaic->cond);
+  g_mutex_unlock (&demosaic->lock);
+}
+
+ArduCamDemosaic *
+arducam_demosaic_new (guint threads)
+{
+  ArduCamDemosaic *demosaic = g_new0 (ArduCamDemosaic, 1);
+
+  if (!threads) threads = g_get_num_processors ();
+  demosaic->threads = threads;
+  demosaic->bands = g_new0 (ArduCamDemosaicBand, threads);
+  for (guint i = 0; i < threads; i++)
+  {
+    demosaic->bands[i].demosaic = demosaic;
+    demosaic->bands[i].index = i;
+  }
+  g_mutex_init (&demosaic->lock);
+  g_cond_init (&demosaic->cond);
+  if (threads > 1)
+  {
+    demosaic->pool = g_thread_pool_new (arducam_demosaic_worker, demosaic, 
+      threads - 1, TRUE, NULL);
+  }
+
+  return demosaic;
+}
+
+void
+arducam_demosaic_free (ArduCamDemosaic * demosaic)
+{
+  if (!demosaic) return;
+
+  if (demosaic->pool) g_thread_pool_free (demosaic->pool, FALSE, TRUE);
+  for (guint i = 0; i < demosaic->threads; i++)
+  {
+    g_free (demosaic->bands[i].scratch);
+  }
+  g_free (demosaic->bands);
+  g_mutex_clear (&demosaic->lock);
+  g_cond_clear (&demosaic->cond);
+  g_free (demosaic);
+}
+
+guint
+arducam_demosaic_get_threads (ArduCamDemosaic * demosaic)
+{
+  return demosaic->threads;
+}
+
+void
+arducam_demosaic_process (ArduCamDemosaic * demosaic, 
+    const guint8 * src, gsize src_stride, guint8 * dst, gsize dst_stride, 
+    guint width, guint height, ArduCamDemosaicFormat format)
+{
+  g_return_if_fail (width >= 2 && height >= 2);
+
+  demosaic->src = src;
+  demosaic->src_stride = src_stride;
+  demosaic->dst = dst;
+  demosaic->dst_stride = dst_stride;
+  demosaic->width = width;
+  demosaic->height = height;
+  demosaic->format = format;
+  // NOTE(marcin.sielski): Small frames are not worth the hand over
+  demosaic->active = demosaic->pool ? MIN (demosaic->threads, height / 16) : 1;
+  if (!demosaic->active) demosaic->active = 1;
+
+  demosaic->pending = demosaic->active - 1;
+  for (guint i = 1; i < demosaic->active; i++)
+  {
+    g_thread_pool_push (demosaic->pool, &demosaic->bands[i], NULL);
+  }
+  arducam_demosaic_band (&demosaic->bands[0]);
+
+  g_mutex_lock (&demosaic->lock);
+  while (demosaic->pending) g_cond_wait (&demosaic->cond, &demosaic->lock);
+  g_mutex_unlock (&demosaic->lock);
+}
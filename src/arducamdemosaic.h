@@ -0,0 +1,52 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef __ARDUCAM_DEMOSAIC_H__
+#define __ARDUCAM_DEMOSAIC_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  ARDUCAM_DEMOSAIC_RGB,
+  ARDUCAM_DEMOSAIC_GRAY8,
+}
+ArduCamDemosaicFormat;
+
+typedef struct _ArduCamDemosaic ArduCamDemosaic;
+
+// NOTE(marcin.sielski): Bilinear demosaic of 8-bit BGGR frames. The frame is
+// split into horizontal bands processed concurrently, the calling thread
+// takes the first band and waits for the remaining ones.
+ArduCamDemosaic *arducam_demosaic_new (guint threads);
+void arducam_demosaic_free (ArduCamDemosaic * demosaic);
+guint arducam_demosaic_get_threads (ArduCamDemosaic * demosaic);
+void arducam_demosaic_process (ArduCamDemosaic * demosaic, 
+    const guint8 * src, gsize src_stride, guint8 * dst, gsize dst_stride, 
+    guint width, guint height, ArduCamDemosaicFormat format);
+
+G_END_DECLS
+
+#endif /* __ARDUCAM_DEMOSAIC_H__ */
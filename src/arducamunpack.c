@@ -0,0 +1,317 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "arducamunpack.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define ARDUCAM_UNPACK_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define ARDUCAM_UNPACK_NEON
+#endif
+
+typedef guint (*ArduCamUnpackFunc) (const guint8 * src, guint16 * dst,
+    guint width, guint shift);
+
+typedef struct
+{
+  const gchar *name;
+  ArduCamUnpackFunc func;
+}
+ArduCamUnpackImpl;
+
+// NOTE(marcin.sielski): Vector kernels process the bulk of the line and
+// return the number of pixels done, the scalar code finishes the rest. The
+// kernels never read past the end of the packed line. Samples are expanded
+// to the most significant bits and shifted right to the requested position.
+
+#ifdef ARDUCAM_UNPACK_X86
+__attribute__ ((target ("ssse3")))
+static guint
+arducam_unpack_gray16_ssse3 (const guint8 * src, guint16 * dst, guint width,
+    guint shift)
+{
+  const __m128i msb = _mm_setr_epi8 (
+    -1, 0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8);
+  const __m128i lsb = _mm_setr_epi8 (
+    4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1);
+  const __m128i weight = _mm_setr_epi16 (64, 16, 4, 1, 64, 16, 4, 1);
+  const __m128i mask = _mm_set1_epi16 (0xC0);
+  const __m128i count = _mm_cvtsi32_si128 (6 - shift);
+  guint bytes = ARDUCAM_RAW10_LINE_SIZE (width);
+  guint x = 0, i = 0;
+
+  for (; i + 16 <= bytes; i += 10, x += 8)
+  {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i lo = _mm_and_si128 (
+      _mm_mullo_epi16 (_mm_shuffle_epi8 (v, lsb), weight), mask);
+    _mm_storeu_si128 ((__m128i *) (dst + x), 
+      _mm_srl_epi16 (_mm_or_si128 (_mm_shuffle_epi8 (v, msb), lo), count));
+  }
+
+  return x;
+}
+
+__attribute__ ((target ("avx2")))
+static guint
+arducam_unpack_gray16_avx2 (const guint8 * src, guint16 * dst, guint width,
+    guint shift)
+{
+  const __m256i msb = _mm256_setr_epi8 (
+    -1, 0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8,
+    -1, 0, -1, 1, -1, 2, -1, 3, -1, 5, -1, 6, -1, 7, -1, 8);
+  const __m256i lsb = _mm256_setr_epi8 (
+    4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1,
+    4, -1, 4, -1, 4, -1, 4, -1, 9, -1, 9, -1, 9, -1, 9, -1);
+  const __m256i weight = _mm256_setr_epi16 (
+    64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1);
+  const __m256i mask = _mm256_set1_epi16 (0xC0);
+  const __m128i count = _mm_cvtsi32_si128 (6 - shift);
+  guint bytes = ARDUCAM_RAW10_LINE_SIZE (width);
+  guint x = 0, i = 0;
+
+  // NOTE(marcin.sielski): Shuffles do not cross 128-bit lanes, each lane
+  // gets its own ten byte group pair
+  for (; i + 26 <= bytes; i += 20, x += 16)
+  {
+    __m256i v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (
+      _mm_loadu_si128 ((const __m128i *) (src + i))), 
+      _mm_loadu_si128 ((const __m128i *) (src + i + 10)), 1);
+    __m256i lo = _mm256_and_si256 (
+      _mm256_mullo_epi16 (_mm256_shuffle_epi8 (v, lsb), weight), mask);
+    _mm256_storeu_si256 ((__m256i *) (dst + x), _mm256_srl_epi16 (
+      _mm256_or_si256 (_mm256_shuffle_epi8 (v, msb), lo), count));
+  }
+
+  return x + arducam_unpack_gray16_ssse3 (src + i, dst + x, width - x, 
+    shift);
+}
+#endif
+
+#ifdef ARDUCAM_UNPACK_NEON
+static guint
+arducam_unpack_gray16_neon (const guint8 * src, guint16 * dst, guint width,
+    guint shift)
+{
+  static const guint8 msb[8] = { 0, 1, 2, 3, 5, 6, 7, 8 };
+  static const guint8 lsb[8] = { 4, 4, 4, 4, 9, 9, 9, 9 };
+  static const gint8 lsb_shifts[8] = { 6, 4, 2, 0, 6, 4, 2, 0 };
+  const uint8x8_t msb_idx = vld1_u8 (msb);
+  const uint8x8_t lsb_idx = vld1_u8 (lsb);
+  const int8x8_t lsb_shift = vld1_s8 (lsb_shifts);
+  const uint8x8_t mask = vdup_n_u8 (0xC0);
+  const int16x8_t count = vdupq_n_s16 ((gint16) shift - 6);
+  guint bytes = ARDUCAM_RAW10_LINE_SIZE (width);
+  guint x = 0, i = 0;
+
+  for (; i + 16 <= bytes; i += 10, x += 8)
+  {
+    uint8x8x2_t v = { { vld1_u8 (src + i), vld1_u8 (src + i + 8) } };
+    uint8x8_t lo = vand_u8 (vshl_u8 (vtbl2_u8 (v, lsb_idx), lsb_shift), mask);
+    uint8x8_t hi = vtbl2_u8 (v, msb_idx);
+    // NOTE(marcin.sielski): Widen and combine as little endian pixels
+    uint16x8_t out = vorrq_u16 (vshll_n_u8 (hi, 8), vmovl_u8 (lo));
+    vst1q_u16 (dst + x, vshlq_u16 (out, count));
+  }
+
+  return x;
+}
+#endif
+
+static guint
+arducam_unpack_gray16_none (const guint8 * src, guint16 * dst, guint width,
+    guint shift)
+{
+  return 0;
+}
+
+static const ArduCamUnpackImpl arducam_unpack_impls[] = {
+#ifdef ARDUCAM_UNPACK_X86
+  { "avx2", arducam_unpack_gray16_avx2 },
+  { "ssse3", arducam_unpack_gray16_ssse3 },
+#endif
+#ifdef ARDUCAM_UNPACK_NEON
+  { "neon", arducam_unpack_gray16_neon },
+#endif
+  { "scalar", arducam_unpack_gray16_none },
+};
+
+static const ArduCamUnpackImpl *arducam_unpack_impl = NULL;
+
+static gboolean
+arducam_unpack_supported (const ArduCamUnpackImpl * impl)
+{
+#ifdef ARDUCAM_UNPACK_X86
+  __builtin_cpu_init ();
+  if (impl->func == arducam_unpack_gray16_avx2) 
+  {
+    return __builtin_cpu_supports ("avx2");
+  }
+  if (impl->func == arducam_unpack_gray16_ssse3)
+  {
+    return __builtin_cpu_supports ("ssse3");
+  }
+#endif
+  return TRUE;
+}
+
+static const ArduCamUnpackImpl *
+arducam_unpack_find (const gchar * name)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (arducam_unpack_impls); i++)
+  {
+    const ArduCamUnpackImpl *impl = &arducam_unpack_impls[i];
+    if (!arducam_unpack_supported (impl)) continue;
+    if (name && !g_str_equal (name, impl->name)) continue;
+    return impl;
+  }
+  return NULL;
+}
+
+static const ArduCamUnpackImpl *
+arducam_unpack_select (void)
+{
+  static gsize selected = 0;
+
+  if (g_once_init_enter (&selected))
+  {
+    // NOTE(marcin.sielski): ARDUCAM_UNPACK forces a particular kernel, useful
+    // to compare them on the same pipeline
+    const ArduCamUnpackImpl *impl = 
+      arducam_unpack_find (g_getenv ("ARDUCAM_UNPACK"));
+    if (!impl) impl = arducam_unpack_find (NULL);
+    g_atomic_pointer_set (&arducam_unpack_impl, impl);
+    g_once_init_leave (&selected, 1);
+  }
+
+  return g_atomic_pointer_get (&arducam_unpack_impl);
+}
+
+static void
+arducam_unpack_raw10_to_16 (const guint8 * src, guint16 * dst, guint width,
+    guint shift)
+{
+  guint x = arducam_unpack_select ()->func (src, dst, width, shift);
+  guint s = 6 - shift;
+
+  for (src += ARDUCAM_RAW10_LINE_SIZE (x); x + 4 <= width; x += 4, src += 5)
+  {
+    guint8 lsb = src[4];
+    dst[x] = GUINT16_TO_LE (((src[0] << 8) | ((lsb << 6) & 0xC0)) >> s);
+    dst[x + 1] = GUINT16_TO_LE (((src[1] << 8) | ((lsb << 4) & 0xC0)) >> s);
+    dst[x + 2] = GUINT16_TO_LE (((src[2] << 8) | ((lsb << 2) & 0xC0)) >> s);
+    dst[x + 3] = GUINT16_TO_LE (((src[3] << 8) | (lsb & 0xC0)) >> s);
+  }
+}
+
+void
+arducam_unpack_raw10_to_gray16 (const guint8 * src, guint16 * dst,
+    guint width)
+{
+  arducam_unpack_raw10_to_16 (src, dst, width, 6);
+}
+
+void
+arducam_unpack_raw10_to_bayer16 (const guint8 * src, guint16 * dst,
+    guint width)
+{
+  arducam_unpack_raw10_to_16 (src, dst, width, 0);
+}
+
+static inline guint32
+arducam_unpack_raw10_sample (const guint8 * src, guint x)
+{
+  const guint8 *group = src + (x >> 2) * 5;
+
+  return (group[x & 3] << 2) | ((group[4] >> ((x & 3) << 1)) & 0x3);
+}
+
+void
+arducam_unpack_raw10_to_gray10_le32 (const guint8 * src, guint32 * dst,
+    guint width)
+{
+  guint x;
+
+  // NOTE(marcin.sielski): Three samples per 32-bit word, the two most
+  // significant bits are padding
+  for (x = 0; x + 3 <= width; x += 3)
+  {
+    *dst++ = GUINT32_TO_LE (arducam_unpack_raw10_sample (src, x) |
+      (arducam_unpack_raw10_sample (src, x + 1) << 10) |
+      (arducam_unpack_raw10_sample (src, x + 2) << 20));
+  }
+  if (x < width)
+  {
+    guint32 word = arducam_unpack_raw10_sample (src, x);
+    if (x + 1 < width) word |= arducam_unpack_raw10_sample (src, x + 1) << 10;
+    *dst = GUINT32_TO_LE (word);
+  }
+}
+
+const gchar *
+arducam_unpack_implementation (void)
+{
+  return arducam_unpack_select ()->name;
+}
+
+const gchar **
+arducam_unpack_implementations (void)
+{
+  static const gchar *names[G_N_ELEMENTS (arducam_unpack_impls) + 1];
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+  {
+    guint n = 0;
+    for (guint i = 0; i < G_N_ELEMENTS (arducam_unpack_impls); i++)
+    {
+      if (!arducam_unpack_supported (&arducam_unpack_impls[i])) continue;
+      names[n++] = arducam_unpack_impls[i].name;
+    }
+    names[n] = NULL;
+    g_once_init_leave (&initialized, 1);
+  }
+
+  return names;
+}
+
+gboolean
+arducam_unpack_set_implementation (const gchar * name)
+{
+  const ArduCamUnpackImpl *impl = arducam_unpack_find (name);
+
+  if (!impl) return FALSE;
+  arducam_unpack_select ();
+  g_atomic_pointer_set (&arducam_unpack_impl, impl);
+
+  return TRUE;
+}
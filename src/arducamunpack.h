@@ -0,0 +1,55 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef __ARDUCAM_UNPACK_H__
+#define __ARDUCAM_UNPACK_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// NOTE(marcin.sielski): MIPI RAW10 packs four pixels into five bytes, the
+// first four bytes hold the eight most significant bits of each pixel and
+// the fifth byte holds the two least significant bits of all four pixels.
+#define ARDUCAM_RAW10_LINE_SIZE(width) ((width) * 5 / 4)
+
+// NOTE(marcin.sielski): GRAY16 samples occupy the most significant bits,
+// bayer samples keep their 10-bit range as expected by bggr10le.
+void arducam_unpack_raw10_to_gray16 (const guint8 * src, guint16 * dst,
+    guint width);
+void arducam_unpack_raw10_to_bayer16 (const guint8 * src, guint16 * dst,
+    guint width);
+void arducam_unpack_raw10_to_gray10_le32 (const guint8 * src, guint32 * dst,
+    guint width);
+const gchar *arducam_unpack_implementation (void);
+
+// NOTE(marcin.sielski): Kernels usable on this CPU, fastest first. The
+// fastest one is used unless the ARDUCAM_UNPACK environment variable or a
+// test selects another.
+const gchar **arducam_unpack_implementations (void);
+gboolean arducam_unpack_set_implementation (const gchar * name);
+
+G_END_DECLS
+
+#endif /* __ARDUCAM_UNPACK_H__ */
@@ -0,0 +1,100 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+#include "gstarducammeta.h"
+
+GType
+gst_ardu_cam_meta_api_get_type (void)
+{
+  static volatile GType type = 0;
+  // NOTE(marcin.sielski): No tags, the meta describes the capture and stays
+  // valid whatever transformation is applied to the frame
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter ((gsize *) & type)) {
+    GType _type = gst_meta_api_type_register ("GstArduCamMetaAPI", tags);
+    g_once_init_leave ((gsize *) & type, _type);
+  }
+
+  return type;
+}
+
+static gboolean
+gst_ardu_cam_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+  GstArduCamMeta *arducam_meta = (GstArduCamMeta *) meta;
+
+  memset ((guint8 *) arducam_meta + sizeof (GstMeta), 0, 
+    sizeof (GstArduCamMeta) - sizeof (GstMeta));
+  arducam_meta->sensor_mode = -1;
+  arducam_meta->fps_d = 1;
+
+  return TRUE;
+}
+
+static gboolean
+gst_ardu_cam_meta_transform (GstBuffer * dest, GstMeta * meta, 
+    GstBuffer * buffer, GQuark type, gpointer data)
+{
+  GstArduCamMeta *arducam_meta = (GstArduCamMeta *) meta;
+
+  // NOTE(marcin.sielski): The meta describes the capture rather than the
+  // pixels, it is copied by copies, scaling and any other transformation
+  GstArduCamMeta *dest_meta = gst_buffer_add_ardu_cam_meta (dest);
+  if (!dest_meta) return FALSE;
+  memcpy ((guint8 *) dest_meta + sizeof (GstMeta), 
+    (guint8 *) arducam_meta + sizeof (GstMeta), 
+    sizeof (GstArduCamMeta) - sizeof (GstMeta));
+
+  return TRUE;
+}
+
+const GstMetaInfo *
+gst_ardu_cam_meta_get_info (void)
+{
+  static const GstMetaInfo *info = NULL;
+
+  if (g_once_init_enter ((GstMetaInfo **) & info)) {
+    const GstMetaInfo *_info = gst_meta_register (GST_ARDU_CAM_META_API_TYPE,
+        "GstArduCamMeta", sizeof (GstArduCamMeta), gst_ardu_cam_meta_init, 
+        NULL, gst_ardu_cam_meta_transform);
+    g_once_init_leave ((GstMetaInfo **) & info, (GstMetaInfo *) _info);
+  }
+
+  return info;
+}
+
+GstArduCamMeta *
+gst_buffer_add_ardu_cam_meta (GstBuffer * buffer)
+{
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+
+  return (GstArduCamMeta *) gst_buffer_add_meta (buffer, 
+    GST_ARDU_CAM_META_INFO, NULL);
+}
@@ -0,0 +1,76 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef __GST_ARDUCAM_META_H__
+#define __GST_ARDUCAM_META_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_ARDU_CAM_META_API_TYPE (gst_ardu_cam_meta_api_get_type ())
+#define GST_ARDU_CAM_META_INFO (gst_ardu_cam_meta_get_info ())
+
+typedef struct _GstArduCamMeta GstArduCamMeta;
+
+// NOTE(marcin.sielski): Settings the sensor had while capturing the frame.
+// Settings of a new generation take effect from frame first_frame, frames
+// captured before while the generation was already applied are marked as
+// transition since registers may have changed during their exposure. Times
+// are g_get_monotonic_time() microseconds.
+struct _GstArduCamMeta
+{
+  GstMeta meta;
+
+  gint camera_num;
+  gint sensor_mode;
+  guint64 sequence;
+  gint64 capture_start;
+  gint64 capture_end;
+  guint32 length;
+
+  guint generation;
+  gboolean transition;
+  gboolean hflip;
+  gboolean vflip;
+  gint shutter_speed;
+  gint gain;
+  gboolean external_trigger;
+  gboolean exposure_mode;
+  gint awb;
+  gint fps_n;
+  gint fps_d;
+};
+
+GType gst_ardu_cam_meta_api_get_type (void);
+const GstMetaInfo *gst_ardu_cam_meta_get_info (void);
+
+#define gst_buffer_get_ardu_cam_meta(b) \
+  ((GstArduCamMeta *) gst_buffer_get_meta ((b), GST_ARDU_CAM_META_API_TYPE))
+
+GstArduCamMeta *gst_buffer_add_ardu_cam_meta (GstBuffer * buffer);
+
+G_END_DECLS
+
+#endif /* __GST_ARDUCAM_META_H__ */
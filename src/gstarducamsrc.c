@@ -28,11 +28,15 @@
 
 #define _GNU_SOURCE
 #include <gst/video/video.h>
+#include <gst/video/gstvideopool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <linux/v4l2-controls.h> 
+#include <linux/videodev2.h>
 #include <unistd.h>
 #include "gstarducamsrc.h"
+#include "arducamunpack.h"
+#include "gstarducammeta.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_ardu_cam_src_debug);
 #define GST_CAT_DEFAULT gst_ardu_cam_src_debug
@@ -52,7 +56,39 @@ enum
   PROP_EXTERNAL_TRIGGER,
   PROP_EXPOSURE_MODE,
   PROP_TIMEOUT,
-  PROP_AWB
+  PROP_AWB,
+  PROP_ZERO_COPY,
+  PROP_MAX_OUTSTANDING_BUFFERS,
+  PROP_POOL_HITS,
+  PROP_POOL_MISSES,
+  PROP_CAPTURE_THREAD,
+  PROP_RING_SIZE,
+  PROP_OVERFLOW_POLICY,
+  PROP_RING_OCCUPANCY,
+  PROP_RING_DROPS,
+  PROP_STATS,
+  PROP_ASYNC_CONTROLS,
+  PROP_WRITES_ISSUED,
+  PROP_WRITES_SUPPRESSED,
+  PROP_DEMOSAIC,
+  PROP_DEMOSAIC_THREADS,
+  PROP_CAMERA_NUM,
+  PROP_SECONDARY_CAMERA_NUM,
+  PROP_PAIR_TOLERANCE,
+  PROP_ROI_X,
+  PROP_ROI_Y,
+  PROP_ROI_WIDTH,
+  PROP_ROI_HEIGHT,
+  PROP_PREWARM,
+  PROP_TIME_TO_FIRST_BUFFER,
+  PROP_TIMESTAMP_MODE,
+  PROP_STATS_INTERVAL,
+  PROP_RECOVERY,
+  PROP_MAX_RETRIES,
+  PROP_QOS,
+  PROP_QOS_THROTTLE,
+  PROP_BATCH_SIZE,
+  PROP_BATCH_TIME
 };
 
 #define WIDTH_DEFAULT 160
@@ -64,20 +100,197 @@ enum
 #define EXPOSURE_MODE_DEFAULT TRUE
 #define ROTATION_DEFAULT 0
 #define TIMEOUT_DEFAULT 5000
+#define ZERO_COPY_DEFAULT FALSE
+#define MAX_OUTSTANDING_BUFFERS_DEFAULT 2
+#define POOL_MIN_BUFFERS 2
+#define POOL_ALIGN 15
+#define CAPTURE_THREAD_DEFAULT FALSE
+#define RING_SIZE_DEFAULT 4
+#define ASYNC_CONTROLS_DEFAULT FALSE
+#define CONTROL_FRAME_TIMEOUT (100 * G_TIME_SPAN_MILLISECOND)
+#define DEMOSAIC_DEFAULT FALSE
+#define DEMOSAIC_THREADS_DEFAULT 0
+#define CAMERA_NUM_DEFAULT 0
+#define PREWARM_DEFAULT FALSE
+#define TIMESTAMP_MODE_DEFAULT GST_ARDU_CAM_SRC_TIMESTAMP_MODE_SENSOR
+#define STATS_INTERVAL_DEFAULT 0
+#define RECOVERY_DEFAULT GST_ARDU_CAM_SRC_RECOVERY_RETRY
+#define MAX_RETRIES_DEFAULT 3
+// NOTE(marcin.sielski): Delay before the first recovery attempt in 
+// microseconds, doubled with every further attempt up to the maximum
+#define RECOVERY_BACKOFF 100000
+#define RECOVERY_BACKOFF_MAX 2000000
+// NOTE(marcin.sielski): Time given to downstream to release the wrapped
+// frames before the camera is reopened, in microseconds
+#define RECOVERY_DRAIN 1000000
+#define RECOVERY_DRAIN_STEP 10000
+// NOTE(marcin.sielski): Returned by capture when a triggered sensor received
+// no trigger within the timeout
+#define ARDUCAM_FLOW_GAP GST_FLOW_CUSTOM_SUCCESS
+// NOTE(marcin.sielski): Returned by capture when the frame would arrive late
+// downstream and was not copied
+#define ARDUCAM_FLOW_SKIP GST_FLOW_CUSTOM_SUCCESS_1
+#define QOS_DEFAULT TRUE
+#define QOS_THROTTLE_DEFAULT FALSE
+// NOTE(marcin.sielski): Number of frames the share of late frames is measured
+// over before the frame rate is lowered
+#define QOS_WINDOW 64
+#define BATCH_SIZE_DEFAULT 1
+#define BATCH_TIME_DEFAULT 20000
+#define TIMESTAMP_WINDOW 256
+#define MAX_CAMERAS 2
+#define SECONDARY_CAMERA_NUM_DEFAULT -1
+#define PAIR_TOLERANCE_DEFAULT 1000
+#define PAIR_MAX_ATTEMPTS 4
+#define ROI_DEFAULT 0
+#define ROI_WIDTH_ALIGN 32
+#define ISP_MARGIN 8
+// NOTE(marcin.sielski): Vertical blanking of the SDK mode register tables,
+// used when the frame length can not be read back from the sensor
+#define VBLANK_LINES_DEFAULT 110
+
+// NOTE(marcin.sielski): Statistics counters are updated from the streaming
+// and capture threads without locking. Counters are 64-bit, GLib has no
+// 64-bit atomics on 32-bit platforms so there the compiler builtins are used
+// instead. Histogram buckets are 32-bit. STATS_ADD returns the value before
+// the addition.
+#define STATS_ADD(field, value) \
+  gst_ardu_cam_src_stats_add (&(field), (value))
+#define STATS_GET(field) gst_ardu_cam_src_stats_get (&(field))
+#define STATS_SET(field, value) \
+  gst_ardu_cam_src_stats_set (&(field), (value))
+#define STATS_MAX(field, value) \
+  gst_ardu_cam_src_stats_max (&(field), (value))
+#define STATS_BUCKET_ADD(field) g_atomic_int_inc (&(field))
+#define STATS_BUCKET_GET(field) ((guint) g_atomic_int_get (&(field)))
+
+#if GLIB_SIZEOF_VOID_P == 8
+static inline guint64
+gst_ardu_cam_src_stats_add (guint64 * field, guint64 value)
+{
+  return (gsize) g_atomic_pointer_add ((gsize *) field, (gssize) value);
+}
+
+static inline guint64
+gst_ardu_cam_src_stats_get (guint64 * field)
+{
+  return (gsize) g_atomic_pointer_get ((gsize *) field);
+}
+
+static inline void
+gst_ardu_cam_src_stats_set (guint64 * field, guint64 value)
+{
+  g_atomic_pointer_set ((gsize *) field, (gsize) value);
+}
+
+static inline gboolean
+gst_ardu_cam_src_stats_exchange (guint64 * field, guint64 expected,
+    guint64 value)
+{
+  return g_atomic_pointer_compare_and_exchange ((gpointer *) field,
+    (gpointer) (gsize) expected, (gpointer) (gsize) value);
+}
+#else
+static inline guint64
+gst_ardu_cam_src_stats_add (guint64 * field, guint64 value)
+{
+  return __atomic_fetch_add (field, value, __ATOMIC_RELAXED);
+}
+
+static inline guint64
+gst_ardu_cam_src_stats_get (guint64 * field)
+{
+  return __atomic_load_n (field, __ATOMIC_RELAXED);
+}
+
+static inline void
+gst_ardu_cam_src_stats_set (guint64 * field, guint64 value)
+{
+  __atomic_store_n (field, value, __ATOMIC_RELAXED);
+}
+
+static inline gboolean
+gst_ardu_cam_src_stats_exchange (guint64 * field, guint64 expected,
+    guint64 value)
+{
+  return __atomic_compare_exchange_n (field, &expected, value, FALSE,
+    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+#endif
+
+// NOTE(marcin.sielski): Maximum is raised with compare and exchange, so a
+// larger value stored concurrently by another thread is never overwritten
+static inline void
+gst_ardu_cam_src_stats_max (guint64 * max, guint64 value)
+{
+  guint64 current = gst_ardu_cam_src_stats_get (max);
+
+  while (value > current &&
+      !gst_ardu_cam_src_stats_exchange (max, current, value))
+  {
+    current = gst_ardu_cam_src_stats_get (max);
+  }
+}
 
 /* the capabilities of the inputs and outputs.
  *
  * describe the real formats here.
  */
 
+// NOTE(marcin.sielski): The template is kept permissive, stereo pairs double
+// the width and the region of interest may be any size, get_caps narrows it
+// down to the modes of the sensor
+#define RAW_CAPS_RANGES \
+  "width = (int) [ 1, 2560 ]," \
+  "height = (int) [ 1, 800 ]," \
+  "framerate = (fraction) [ 0, max ], " \
+  "sensor-mode = (int) [ -1, 22 ], " \
+  "timeout = (int) [ -1, max ]"
+
 #define RAW_CAPS \
   "video/x-raw, " \
-  "width = (int) { 160, 320, 640, 1280 }," \
-  "height = (int) { 100, 200, 400, 720, 800 }," \
-  "format = (string) GRAY8," \
-  "framerate = (fraction) [ 0, 480 ], " \
-  "sensor-mode = (int) [ -1, 22 ], " \
-  "timeout = (int) [ -1, max ] "
+  "format = (string) { GRAY8, GRAY16_LE, GRAY10_LE32, RGB }," \
+  RAW_CAPS_RANGES "; " \
+  "video/x-y10p, " \
+  RAW_CAPS_RANGES "; " \
+  "video/x-bayer, " \
+  "format = (string) { bggr, bggr10le }," \
+  RAW_CAPS_RANGES
+
+// NOTE(marcin.sielski): SDK pads every line to 32 bytes
+#define SDK_STRIDE(line_size) GST_ROUND_UP_32 (line_size)
+
+// NOTE(marcin.sielski): Indexed by GstArduCamSrcSensorMode, frame rate of 
+// ETM modes is limited by the trigger. Lanes and frame rates are not reported
+// by the SDK.
+static const ArduCamModeInfo sensor_modes[ARDUCAM_SENSOR_MODES] = {
+  {1280, 800, V4L2_PIX_FMT_GREY, 60, 1, FALSE},
+  {1280, 720, V4L2_PIX_FMT_GREY, 60, 1, FALSE},
+  {640, 400, V4L2_PIX_FMT_GREY, 210, 1, FALSE},
+  {320, 200, V4L2_PIX_FMT_GREY, 420, 1, FALSE},
+  {160, 100, V4L2_PIX_FMT_GREY, 480, 1, FALSE},
+  {1280, 800, V4L2_PIX_FMT_GREY, 480, 2, FALSE},
+  {1280, 800, V4L2_PIX_FMT_Y10P, 480, 2, FALSE},
+  {1280, 800, V4L2_PIX_FMT_GREY, 60, 1, TRUE},
+  {1280, 720, V4L2_PIX_FMT_GREY, 60, 1, TRUE},
+  {640, 400, V4L2_PIX_FMT_GREY, 60, 1, TRUE},
+  {320, 200, V4L2_PIX_FMT_GREY, 60, 1, TRUE},
+  {1280, 800, V4L2_PIX_FMT_GREY, 60, 2, TRUE},
+  {1280, 800, V4L2_PIX_FMT_Y10P, 60, 2, TRUE},
+  {1280, 720, V4L2_PIX_FMT_GREY, 60, 2, TRUE},
+  {640, 400, V4L2_PIX_FMT_GREY, 60, 2, TRUE},
+  {320, 200, V4L2_PIX_FMT_GREY, 60, 2, TRUE},
+  {1280, 800, V4L2_PIX_FMT_SBGGR8, 60, 1, FALSE},
+  {1280, 720, V4L2_PIX_FMT_SBGGR8, 60, 1, FALSE},
+  {640, 400, V4L2_PIX_FMT_SBGGR8, 210, 1, FALSE},
+  {320, 200, V4L2_PIX_FMT_SBGGR8, 420, 1, FALSE},
+  {160, 100, V4L2_PIX_FMT_SBGGR8, 480, 1, FALSE},
+  {1280, 800, V4L2_PIX_FMT_SBGGR8, 480, 2, FALSE},
+  {1280, 800, V4L2_PIX_FMT_SBGGR10P, 480, 1, FALSE},
+};
+
+#define SENSOR_WIDTH 1280
+#define SENSOR_HEIGHT 800
 
 static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
@@ -95,10 +308,21 @@ static GstFlowReturn gst_ardu_cam_src_create (GstPushSrc * parent,
     GstBuffer ** buf);
 static GstCaps *gst_ardu_cam_src_get_caps (GstBaseSrc * src, GstCaps * filter);
 static gboolean gst_ardu_cam_src_set_caps (GstBaseSrc * src, GstCaps * caps);
+static GstStateChangeReturn gst_ardu_cam_src_change_state (
+    GstElement * element, GstStateChange transition);
 static gboolean gst_ardu_cam_src_start (GstBaseSrc * parent);
 static gboolean gst_ardu_cam_src_stop (GstBaseSrc * parent);
+static gboolean gst_ardu_cam_src_prewarm (GstArduCamSrc * src);
+static gboolean gst_ardu_cam_src_switch_mode (GstArduCamSrc * src, 
+    gint sensor_mode);
 static gboolean gst_ardu_cam_src_decide_allocation (GstBaseSrc * src,
     GstQuery * query);
+static GstStructure *gst_ardu_cam_src_get_stats (GstArduCamSrc * src);
+static gint64 gst_ardu_cam_src_time_to_first_buffer (GstArduCamSrc * src);
+static gboolean gst_ardu_cam_src_unlock (GstBaseSrc * parent);
+static gboolean gst_ardu_cam_src_unlock_stop (GstBaseSrc * parent);
+static gboolean gst_ardu_cam_src_query (GstBaseSrc * bsrc, GstQuery * query);
+static gboolean gst_ardu_cam_src_event (GstBaseSrc * bsrc, GstEvent * event);
 
 #define gst_ardu_cam_src_parent_class parent_class
 G_DEFINE_TYPE (GstArduCamSrc, gst_ardu_cam_src, 
@@ -328,27 +552,518 @@ gst_ardu_cam_src_awb_get_type (void)
   return id;
 }
 
+GType
+gst_ardu_cam_src_overflow_policy_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {C_ENUM (GST_ARDU_CAM_SRC_OVERFLOW_POLICY_DROP_OLDEST), 
+        "GST_ARDU_CAM_SRC_OVERFLOW_POLICY_DROP_OLDEST",
+        "drop-oldest"},
+    {C_ENUM (GST_ARDU_CAM_SRC_OVERFLOW_POLICY_DROP_NEWEST), 
+        "GST_ARDU_CAM_SRC_OVERFLOW_POLICY_DROP_NEWEST",
+        "drop-newest"},
+    {C_ENUM (GST_ARDU_CAM_SRC_OVERFLOW_POLICY_BLOCK), 
+        "GST_ARDU_CAM_SRC_OVERFLOW_POLICY_BLOCK",
+        "block"},
+    {0, NULL, NULL}
+  };
+
+  static volatile GType id = 0;
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+    _id = g_enum_register_static ("GstArduCamSrcOverflowPolicy", values);
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
+GType
+gst_ardu_cam_src_timestamp_mode_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {C_ENUM (GST_ARDU_CAM_SRC_TIMESTAMP_MODE_ARRIVAL), 
+        "GST_ARDU_CAM_SRC_TIMESTAMP_MODE_ARRIVAL",
+        "arrival"},
+    {C_ENUM (GST_ARDU_CAM_SRC_TIMESTAMP_MODE_SENSOR), 
+        "GST_ARDU_CAM_SRC_TIMESTAMP_MODE_SENSOR",
+        "sensor"},
+    {0, NULL, NULL}
+  };
+
+  static volatile GType id = 0;
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+    _id = g_enum_register_static ("GstArduCamSrcTimestampMode", values);
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
+GType
+gst_ardu_cam_src_recovery_get_type (void)
+{
+  static const GEnumValue values[] = {
+    {C_ENUM (GST_ARDU_CAM_SRC_RECOVERY_ERROR), 
+        "GST_ARDU_CAM_SRC_RECOVERY_ERROR",
+        "error"},
+    {C_ENUM (GST_ARDU_CAM_SRC_RECOVERY_RETRY), 
+        "GST_ARDU_CAM_SRC_RECOVERY_RETRY",
+        "retry"},
+    {0, NULL, NULL}
+  };
+
+  static volatile GType id = 0;
+  if (g_once_init_enter ((gsize *) & id)) {
+    GType _id;
+    _id = g_enum_register_static ("GstArduCamSrcRecovery", values);
+    g_once_init_leave ((gsize *) & id, _id);
+  }
+
+  return id;
+}
+
+
+// NOTE(marcin.sielski): Cameras opened in this process, a camera can be used
+// by a single element at a time. Buffers wrapped for zero-copy output hold a
+// reference to the camera of their SDK buffer, the last reference closes it,
+// so an element may stop while downstream still holds its frames.
+typedef struct
+{
+  CAMERA_INSTANCE instance;
+  gint refcount;
+  gboolean owned;
+}
+ArduCamInstance;
+
+static GMutex cameras_lock;
+static ArduCamInstance cameras[MAX_CAMERAS];
+
+// NOTE(marcin.sielski): Must be called with the camera lock held
+static void
+gst_ardu_cam_src_shadow_invalidate (ArduCamCamera * camera)
+{
+  camera->shadow.controls_valid = 0;
+  camera->shadow.registers_valid = 0;
+}
 
-static IMAGE_FORMAT image_format = {IMAGE_ENCODING_RAW_BAYER, 100};
-static CAMERA_INSTANCE camera_instance = NULL;
+static void
+gst_ardu_cam_src_close_instance (CAMERA_INSTANCE instance)
+{
+  // NOTE(marcin.sielski):arducam_close_camera segfaults if exposure mode is 
+  // enabled and then disabled
+  arducam_software_auto_exposure(instance, TRUE);
+  if (arducam_close_camera (instance))
+  {
+    GST_WARNING ("Failed to close camera");
+  }
+}
 
 static void 
 gst_ardu_cam_src_atexit (void)
 {
   GST_LOG ("gst_ardu_cam_src_atexit entry");
-  if (camera_instance)
+  g_mutex_lock (&cameras_lock);
+  for (gint i = 0; i < MAX_CAMERAS; i++)
   {
-    // NOTE(marcin.sielski):arducam_close_camera segfaults if exposure mode is 
-    // enabled and then disabled
-    arducam_software_auto_exposure(camera_instance, TRUE);
-    if (arducam_close_camera (camera_instance))
+    if (cameras[i].instance) 
     {
-      GST_WARNING ("Failed to close camera");
+      gst_ardu_cam_src_close_instance (cameras[i].instance);
     }
+    memset (&cameras[i], 0, sizeof (ArduCamInstance));
   }
+  g_mutex_unlock (&cameras_lock);
   GST_LOG ("gst_ardu_cam_src_atexit exit");
 }
 
+static void
+gst_ardu_cam_src_ref_instance (gint num)
+{
+  g_mutex_lock (&cameras_lock);
+  cameras[num].refcount++;
+  g_mutex_unlock (&cameras_lock);
+}
+
+static void
+gst_ardu_cam_src_unref_instance (gint num)
+{
+  g_mutex_lock (&cameras_lock);
+  if (!--cameras[num].refcount)
+  {
+    gst_ardu_cam_src_close_instance (cameras[num].instance);
+    cameras[num].instance = NULL;
+    GST_DEBUG ("Closed camera %d", num);
+  }
+  g_mutex_unlock (&cameras_lock);
+}
+
+// NOTE(marcin.sielski): Closing a camera referenced by buffers besides its
+// owner leaves the SDK instance open
+static gboolean
+gst_ardu_cam_src_instance_shared (ArduCamCamera * camera)
+{
+  gboolean shared;
+
+  if (!camera->instance) return FALSE;
+  g_mutex_lock (&cameras_lock);
+  shared = cameras[camera->num].refcount > 1;
+  g_mutex_unlock (&cameras_lock);
+
+  return shared;
+}
+
+static gboolean
+gst_ardu_cam_src_open_camera (GstArduCamSrc * src, ArduCamCamera * camera,
+    gint num)
+{
+  CAMERA_INSTANCE instance = NULL;
+
+  g_mutex_lock (&cameras_lock);
+  if (cameras[num].owned)
+  {
+    g_mutex_unlock (&cameras_lock);
+    GST_ERROR_OBJECT (src, "Camera %d is already in use", num);
+    return FALSE;
+  }
+  // NOTE(marcin.sielski): A camera still referenced by buffers of a previous
+  // run is open and is taken over as is
+  instance = cameras[num].instance;
+  if (instance)
+  {
+    GST_DEBUG_OBJECT (src, "Camera %d is still open, %d buffers outstanding",
+      num, cameras[num].refcount);
+  }
+  // NOTE(marcin.sielski): Camera 0 keeps the default SDK initialization,
+  // others select the MIPI interface with the Compute Module pin mapping
+  else if (num == 0)
+  {
+    if (arducam_init_camera (&instance)) instance = NULL;
+  }
+  else
+  {
+    struct camera_interface cam_interface = {
+      .i2c_bus = 0,
+      .camera_num = num,
+      .sda_pins = { 28, 0 },
+      .scl_pins = { 29, 1 },
+      .led_pins = { 30, 2 },
+      .shutdown_pins = { 31, 3 },
+    };
+    if (arducam_init_camera2 (&instance, cam_interface)) instance = NULL;
+  }
+  if (instance)
+  {
+    cameras[num].instance = instance;
+    cameras[num].refcount++;
+    cameras[num].owned = TRUE;
+  }
+  g_mutex_unlock (&cameras_lock);
+
+  if (!instance)
+  {
+    GST_ERROR_OBJECT (src, "Failed to initialize the camera %d", num);
+    return FALSE;
+  }
+
+  g_mutex_lock (&camera->lock);
+  GST_OBJECT_LOCK (src);
+  camera->num = num;
+  camera->instance = instance;
+  GST_OBJECT_UNLOCK (src);
+  camera->format.encoding = IMAGE_ENCODING_RAW_BAYER;
+  camera->format.quality = 100;
+  camera->warm = FALSE;
+  gst_ardu_cam_src_shadow_invalidate (camera);
+  g_mutex_unlock (&camera->lock);
+
+  GST_DEBUG_OBJECT (src, "Opened camera %d", num);
+
+  return TRUE;
+}
+
+// NOTE(marcin.sielski): The camera is closed once downstream releases the
+// buffers wrapping its SDK buffers
+static void
+gst_ardu_cam_src_close_camera (GstArduCamSrc * src, ArduCamCamera * camera)
+{
+  CAMERA_INSTANCE instance;
+
+  g_mutex_lock (&camera->lock);
+  GST_OBJECT_LOCK (src);
+  instance = camera->instance;
+  camera->instance = NULL;
+  GST_OBJECT_UNLOCK (src);
+  g_mutex_unlock (&camera->lock);
+  if (!instance) return;
+
+  g_mutex_lock (&cameras_lock);
+  cameras[camera->num].owned = FALSE;
+  g_mutex_unlock (&cameras_lock);
+  gst_ardu_cam_src_unref_instance (camera->num);
+
+  GST_DEBUG_OBJECT (src, "Released camera %d", camera->num);
+}
+
+// NOTE(marcin.sielski): Application threads calling the SDK take a
+// reference, the camera then stays open until the call returns. NULL when
+// the camera is not open.
+static CAMERA_INSTANCE
+gst_ardu_cam_src_get_instance (GstArduCamSrc * src, gint * num)
+{
+  CAMERA_INSTANCE instance;
+
+  GST_OBJECT_LOCK (src);
+  instance = src->camera.instance;
+  *num = src->camera.num;
+  if (instance) gst_ardu_cam_src_ref_instance (*num);
+  GST_OBJECT_UNLOCK (src);
+
+  return instance;
+}
+
+static void
+gst_ardu_cam_src_close (GstArduCamSrc * src)
+{
+  gst_ardu_cam_src_close_camera (src, &src->secondary);
+  gst_ardu_cam_src_close_camera (src, &src->camera);
+}
+
+// NOTE(marcin.sielski): Modes supported by the SDK replace the static table,
+// which is kept as is when the SDK does not report any
+static void
+gst_ardu_cam_src_load_modes (GstArduCamSrc * src)
+{
+  ArduCamModeInfo modes[ARDUCAM_SENSOR_MODES];
+  struct format format;
+  gint count = 0;
+
+  memset (modes, 0, sizeof (modes));
+  for (gint index = 0; !arducam_get_support_formats (src->camera.instance, 
+    &format, index); index++)
+  {
+    if (format.mode < 0 || format.mode >= ARDUCAM_SENSOR_MODES) continue;
+    modes[format.mode] = sensor_modes[format.mode];
+    modes[format.mode].width = format.width;
+    modes[format.mode].height = format.height;
+    modes[format.mode].pixelformat = format.pixelformat;
+    count++;
+  }
+  // NOTE(marcin.sielski): Caps queries read the modes from other threads
+  GST_OBJECT_LOCK (src);
+  if (count) memcpy (src->modes, modes, sizeof (src->modes));
+  else memcpy (src->modes, sensor_modes, sizeof (src->modes));
+  GST_OBJECT_UNLOCK (src);
+
+  GST_DEBUG_OBJECT (src, "SDK reports %d sensor modes", count);
+}
+
+static gboolean
+gst_ardu_cam_src_open (GstArduCamSrc * src)
+{
+  GST_OBJECT_LOCK (src);
+  gint camera_num = src->camera_num;
+  gint secondary_camera_num = src->secondary_camera_num;
+  GST_OBJECT_UNLOCK (src);
+  if (!gst_ardu_cam_src_open_camera (src, &src->camera, camera_num))
+  {
+    return FALSE;
+  }
+
+  // NOTE(marcin.sielski): Sensor identification is read once per open, the
+  // registers never change afterwards. Properties read it under the object
+  // lock.
+  CAMERA_INSTANCE instance = src->camera.instance;
+  gchar name[sizeof (src->name)];
+  gchar revision[sizeof (src->revision)];
+  name[0] = 'o';
+  name[1] = 'v';
+  guint16 value = 0;
+  if (arducam_read_sensor_reg(instance, 0x300A, &value)) 
+  {
+    GST_WARNING_OBJECT(src, "Failed to read camera id");
+  }
+  sprintf(name+2, "%x", value);
+  if (arducam_read_sensor_reg(instance, 0x300B, &value))
+  {
+    GST_WARNING_OBJECT(src, "Failed to read camera id");
+  }
+  sprintf(name+4, "%x", value);
+  name[6] = 0;
+  if (arducam_read_sensor_reg(instance, 0x300C, &value))
+  {
+    GST_WARNING_OBJECT(src, "Failed to read revision id");
+  }
+  sprintf(revision, "%x", value);
+  revision[2] = 0;
+  GST_OBJECT_LOCK (src);
+  memcpy (src->name, name, sizeof (src->name));
+  memcpy (src->revision, revision, sizeof (src->revision));
+  GST_OBJECT_UNLOCK (src);
+
+  GST_DEBUG_OBJECT (src, "Sensor %s revision %s", name, revision);
+
+  gst_ardu_cam_src_load_modes (src);
+  memset (src->mode_vblank, 0, sizeof (src->mode_vblank));
+  src->mode_configured = FALSE;
+
+  if (secondary_camera_num < 0) return TRUE;
+  if (secondary_camera_num == camera_num)
+  {
+    GST_ERROR_OBJECT (src, "Secondary camera must differ from the primary one");
+  }
+  else if (gst_ardu_cam_src_open_camera (src, &src->secondary, 
+    secondary_camera_num))
+  {
+    return TRUE;
+  }
+  gst_ardu_cam_src_close (src);
+
+  return FALSE;
+}
+
+static void
+gst_ardu_cam_src_config_write_begin (ArduCamConfig * config)
+{
+  g_mutex_lock (&config->lock);
+  g_atomic_int_inc (&config->sequence);
+}
+
+static void
+gst_ardu_cam_src_config_write_end (ArduCamConfig * config, 
+    ArduCamPropChangeFlags change_flags)
+{
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  g_atomic_int_inc (&config->sequence);
+  if (change_flags) g_atomic_int_or (&config->change_flags, change_flags);
+  g_mutex_unlock (&config->lock);
+}
+
+static void
+gst_ardu_cam_src_config_read (ArduCamConfig * config, 
+    ArduCamSettings * settings)
+{
+  gint sequence;
+
+  do
+  {
+    while ((sequence = g_atomic_int_get (&config->sequence)) & 1);
+    *settings = config->settings;
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  }
+  while (g_atomic_int_get (&config->sequence) != sequence);
+}
+
+static gboolean
+gst_ardu_cam_src_roi_enabled (GstArduCamSrc * src)
+{
+  return src->roi_width > 0 && src->roi_height > 0;
+}
+
+// NOTE(marcin.sielski): Line time is fixed by the mode, the frame rate
+// scales with the number of lines read out plus vertical blanking
+static gdouble
+gst_ardu_cam_src_mode_fps (const ArduCamModeInfo * info, gint height, 
+    gint vblank)
+{
+  return (gdouble) info->fps * (info->height + vblank) / (height + vblank);
+}
+
+static void
+gst_ardu_cam_src_control_wake (GstArduCamSrc * src)
+{
+  if (!src->control.thread) return;
+
+  g_mutex_lock (&src->control.lock);
+  g_cond_signal (&src->control.cond);
+  g_mutex_unlock (&src->control.lock);
+}
+
+// NOTE(marcin.sielski): Maps g_get_monotonic_time() microseconds to the
+// running time of the pipeline clock
+static GstClockTime
+gst_ardu_cam_src_running_time (GstArduCamSrc * src, gint64 time)
+{
+  GstClock *clock = gst_element_get_clock (GST_ELEMENT (src));
+  if (!clock) return GST_CLOCK_TIME_NONE;
+
+  GstClockTime age = MAX (g_get_monotonic_time () - time, 0) * GST_USECOND;
+  GstClockTime now = gst_clock_get_time (clock);
+  GstClockTime base_time = gst_element_get_base_time (GST_ELEMENT (src));
+  GstClockTime capture = now > age ? now - age : 0;
+  gst_object_unref (clock);
+
+  return capture > base_time ? capture - base_time : 0;
+}
+
+static gdouble
+gst_ardu_cam_src_get_sensor_fps (GstArduCamSrc * src)
+{
+  return g_atomic_int_get (&src->sensor_fps) / 1000.0;
+}
+
+static void
+gst_ardu_cam_src_set_sensor_fps (GstArduCamSrc * src, gdouble fps)
+{
+  g_atomic_int_set (&src->sensor_fps, (gint) (fps * 1000 + 0.5));
+}
+
+// NOTE(marcin.sielski): A frame is delivered one frame period after its
+// readout started plus processing, queued frames of the capture thread may
+// delay it further. The frame rate of the caps bounds the one of the mode, 
+// triggered sensors are assumed to run at the bound.
+static gboolean
+gst_ardu_cam_src_latency (GstArduCamSrc * src, GstClockTime * min, 
+    GstClockTime * max)
+{
+  ArduCamSettings settings;
+  gdouble fps = gst_ardu_cam_src_get_sensor_fps (src);
+
+  if (!src->mode_configured || fps <= 0) return FALSE;
+
+  gst_ardu_cam_src_config_read (&src->config, &settings);
+  if (settings.fps_n > 0 && settings.fps_d > 0)
+  {
+    fps = MIN (fps, (gdouble) settings.fps_n / settings.fps_d);
+  }
+  GstClockTime period = (GstClockTime) (GST_SECOND / fps);
+  *min = period + STATS_GET (src->stats.processing_time) * GST_USECOND;
+  *max = *min;
+  if (src->capture_thread) *max += src->ring_size * period;
+#if GST_CHECK_VERSION (1, 14, 0)
+  // NOTE(marcin.sielski): The first frame of a batch waits for the others
+  if (src->batch_size > 1)
+  {
+    GstClockTime batch = (src->batch_size - 1) * period;
+    if (src->batch_time) batch = MIN (batch, src->batch_time * GST_USECOND);
+    *min += batch;
+    *max += batch;
+  }
+#endif
+
+  return TRUE;
+}
+
+// NOTE(marcin.sielski): Posts latency message when the latency changes by
+// more than 1/8, the pipeline then queries it again
+static void
+gst_ardu_cam_src_update_latency (GstArduCamSrc * src)
+{
+  GstClockTime min, max;
+
+  if (!gst_ardu_cam_src_latency (src, &min, &max)) return;
+
+  GstClockTime latency = STATS_GET (src->latency);
+  if (GST_CLOCK_TIME_IS_VALID (latency) && min <= latency + latency / 8 && 
+    min + min / 8 >= latency) return;
+  STATS_SET (src->latency, min);
+
+  GST_DEBUG_OBJECT (src, "Latency changed to %" GST_TIME_FORMAT, 
+    GST_TIME_ARGS (min));
+  gst_element_post_message (GST_ELEMENT (src), 
+    gst_message_new_latency (GST_OBJECT (src)));
+}
+
 /* GObject vmethod implementations */
 
 /* initialize the arducamsrc's class */
@@ -368,6 +1083,8 @@ gst_ardu_cam_src_class_init (GstArduCamSrcClass * klass)
   gobject_class->finalize = gst_ardu_cam_src_finalize;
   gobject_class->set_property = gst_ardu_cam_src_set_property;
   gobject_class->get_property = gst_ardu_cam_src_get_property;
+  gstelement_class->change_state = 
+      GST_DEBUG_FUNCPTR (gst_ardu_cam_src_change_state);
   gst_element_class_set_static_metadata (gstelement_class,
     "ArduCamSrc",
     "Source/Video",
@@ -381,6 +1098,10 @@ gst_ardu_cam_src_class_init (GstArduCamSrcClass * klass)
       GST_DEBUG_FUNCPTR (gst_ardu_cam_src_decide_allocation);
   basesrc_class->get_caps = GST_DEBUG_FUNCPTR (gst_ardu_cam_src_get_caps);
   basesrc_class->set_caps = GST_DEBUG_FUNCPTR (gst_ardu_cam_src_set_caps);
+  basesrc_class->unlock = GST_DEBUG_FUNCPTR (gst_ardu_cam_src_unlock);
+  basesrc_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_ardu_cam_src_unlock_stop);
+  basesrc_class->query = GST_DEBUG_FUNCPTR (gst_ardu_cam_src_query);
+  basesrc_class->event = GST_DEBUG_FUNCPTR (gst_ardu_cam_src_event);
   pushsrc_class->create = gst_ardu_cam_src_create;  
 
   g_object_class_install_property (gobject_class, PROP_SENSOR_NAME,
@@ -439,6 +1160,204 @@ gst_ardu_cam_src_class_init (GstArduCamSrcClass * klass)
           "Set or get auto wihite balance.", gst_ardu_cam_src_awb_get_type(),
           GST_ARDU_CAM_SRC_AWB_1_00X, 
           G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ZERO_COPY,
+      g_param_spec_boolean ("zero-copy", "Zero Copy", 
+          "Wrap SDK capture buffers instead of copying them.", 
+          ZERO_COPY_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_OUTSTANDING_BUFFERS,
+      g_param_spec_int ("max-outstanding-buffers", "Max Outstanding Buffers", 
+          "Maximum number of SDK buffers held downstream before falling back "
+          "to copying.", 1, G_MAXINT, MAX_OUTSTANDING_BUFFERS_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_POOL_HITS,
+      g_param_spec_uint ("pool-hits", "Pool Hits", 
+          "Get number of frames copied into recycled pool buffers.", 
+          0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_POOL_MISSES,
+      g_param_spec_uint ("pool-misses", "Pool Misses", 
+          "Get number of frames that required a fresh buffer allocation.", 
+          0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CAPTURE_THREAD,
+      g_param_spec_boolean ("capture-thread", "Capture Thread", 
+          "Capture frames on a dedicated thread decoupled from streaming.", 
+          CAPTURE_THREAD_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_RING_SIZE,
+      g_param_spec_int ("ring-size", "Ring Size", 
+          "Number of frames buffered between the capture thread and streaming "
+          "thread (rounded up to a power of two).", 1, 64, RING_SIZE_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_OVERFLOW_POLICY,
+      g_param_spec_enum ("overflow-policy", "Overflow Policy", 
+          "Set or get the capture thread behavior when the ring is full.", 
+          gst_ardu_cam_src_overflow_policy_get_type(), 
+          GST_ARDU_CAM_SRC_OVERFLOW_POLICY_DROP_OLDEST, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_RING_OCCUPANCY,
+      g_param_spec_uint ("ring-occupancy", "Ring Occupancy", 
+          "Get number of captured frames waiting in the ring.", 
+          0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_RING_DROPS,
+      g_param_spec_uint ("ring-drops", "Ring Drops", 
+          "Get number of frames dropped because the ring was full.", 
+          0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics", 
+          "Get capture statistics: frames, achieved fps, create() time "
+          "percentiles (us), bytes copied and allocations per frame, time "
+          "to first buffer (us), sensor frames, timeouts and capture, copy, "
+          "control and push times (us).", GST_TYPE_STRUCTURE, 
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ASYNC_CONTROLS,
+      g_param_spec_boolean ("async-controls", "Asynchronous Controls", 
+          "Apply control changes on a background thread between frames.", 
+          ASYNC_CONTROLS_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_WRITES_ISSUED,
+      g_param_spec_uint64 ("writes-issued", "Writes Issued", 
+          "Get number of control and register writes sent to the sensor.", 
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_WRITES_SUPPRESSED,
+      g_param_spec_uint64 ("writes-suppressed", "Writes Suppressed", 
+          "Get number of control and register writes skipped because the "
+          "sensor already holds the value.", 
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DEMOSAIC,
+      g_param_spec_boolean ("demosaic", "Demosaic", 
+          "Demosaic bayer sensor modes to RGB or GRAY8 video/x-raw output.", 
+          DEMOSAIC_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DEMOSAIC_THREADS,
+      g_param_spec_int ("demosaic-threads", "Demosaic Threads", 
+          "Number of threads demosaicing a frame. (0 = Number of CPUs)", 
+          0, 64, DEMOSAIC_THREADS_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CAMERA_NUM,
+      g_param_spec_int ("camera-num", "Camera Number", 
+          "Set or get MIPI interface the camera is connected to, takes effect "
+          "when the camera is opened.", 
+          0, MAX_CAMERAS - 1, CAMERA_NUM_DEFAULT, 
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SECONDARY_CAMERA_NUM,
+      g_param_spec_int ("secondary-camera-num", "Secondary Camera Number", 
+          "Set or get MIPI interface of the second camera of a stereo pair, "
+          "its frames are placed right of the primary camera frames. "
+          "(-1 = Disabled)", 
+          -1, MAX_CAMERAS - 1, SECONDARY_CAMERA_NUM_DEFAULT, 
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAIR_TOLERANCE,
+      g_param_spec_int ("pair-tolerance", "Pair Tolerance", 
+          "Maximum difference of stereo frame timestamps, in microseconds, "
+          "frames further apart are resynchronized.", 
+          0, G_MAXINT, PAIR_TOLERANCE_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ROI_X,
+      g_param_spec_int ("roi-x", "ROI X", 
+          "Set or get left edge of the sensor region of interest.", 
+          0, SENSOR_WIDTH - ROI_WIDTH_ALIGN, ROI_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ROI_Y,
+      g_param_spec_int ("roi-y", "ROI Y", 
+          "Set or get top edge of the sensor region of interest.", 
+          0, SENSOR_HEIGHT - 2, ROI_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ROI_WIDTH,
+      g_param_spec_int ("roi-width", "ROI Width", 
+          "Set or get width of the sensor region of interest, a multiple of "
+          "32. The sensor reads out only the region, in 1280x800 modes. "
+          "(0 = Disabled)", 
+          0, SENSOR_WIDTH, ROI_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ROI_HEIGHT,
+      g_param_spec_int ("roi-height", "ROI Height", 
+          "Set or get height of the sensor region of interest, fewer lines "
+          "raise the frame rate. (0 = Disabled)", 
+          0, SENSOR_HEIGHT, ROI_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PREWARM,
+      g_param_spec_boolean ("prewarm", "Pre-warm", 
+          "Open the camera and configure the sensor mode in READY instead of "
+          "on start, so that the first frame follows PLAYING within a frame "
+          "period.", 
+          PREWARM_DEFAULT, 
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_TIME_TO_FIRST_BUFFER,
+      g_param_spec_int64 ("time-to-first-buffer", "Time To First Buffer", 
+          "Get time from the transition to PLAYING to the first buffer, in "
+          "microseconds. (-1 = No buffer yet)", 
+          -1, G_MAXINT64, -1, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_TIMESTAMP_MODE,
+      g_param_spec_enum ("timestamp-mode", "Timestamp Mode", 
+          "Set or get the source of buffer timestamps: the SDK frame "
+          "timestamp or the time create() returns.", 
+          gst_ardu_cam_src_timestamp_mode_get_type(), 
+          TIMESTAMP_MODE_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics Interval", 
+          "Post the statistics as an element message on the bus every given "
+          "number of milliseconds. (0 = Disabled)", 
+          0, G_MAXINT, STATS_INTERVAL_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_RECOVERY,
+      g_param_spec_enum ("recovery", "Recovery", 
+          "Set or get the behavior when a frame can not be captured: fail, or "
+          "send a gap while waiting for a trigger and reset the sensor mode "
+          "or reopen the camera otherwise.", 
+          gst_ardu_cam_src_recovery_get_type(), RECOVERY_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_RETRIES,
+      g_param_spec_int ("max-retries", "Maximum Retries", 
+          "Number of attempts to recover from a capture failure before an "
+          "error is posted.", 
+          0, 16, MAX_RETRIES_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_QOS,
+      g_param_spec_boolean ("qos", "QoS", 
+          "Skip frames that would arrive late downstream according to QoS "
+          "events.", 
+          QOS_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_QOS_THROTTLE,
+      g_param_spec_boolean ("qos-throttle", "QoS Throttle", 
+          "Lower the sensor frame rate to the share of frames downstream "
+          "keeps up with when most frames are late.", 
+          QOS_THROTTLE_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_BATCH_SIZE,
+      g_param_spec_int ("batch-size", "Batch Size", 
+          "Number of frames pushed downstream at once as a buffer list, "
+          "requires GStreamer 1.14. (1 = No batching)", 
+          1, 64, BATCH_SIZE_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_BATCH_TIME,
+      g_param_spec_int ("batch-time", "Batch Time", 
+          "Maximum time the first frame of a batch waits for the others, in "
+          "microseconds. (0 = Unlimited)", 
+          0, G_MAXINT, BATCH_TIME_DEFAULT, 
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING | 
+          G_PARAM_STATIC_STRINGS));
 
     atexit (gst_ardu_cam_src_atexit);
 }
@@ -455,51 +1374,80 @@ gst_ardu_cam_src_init (GstArduCamSrc * src)
   gst_base_src_set_live (GST_BASE_SRC (src), TRUE);
   gst_base_src_set_do_timestamp (GST_BASE_SRC (src), TRUE);
 
-  if (!camera_instance)
-  {
-    if (arducam_init_camera (&camera_instance)) 
-    {
-      GST_ERROR_OBJECT(src, "Failed to initialize the camera");
-      return;
-    }
-    src->name[0] = 'o';
-    src->name[1] = 'v';
-    guint16 value = 0;
-    if (arducam_read_sensor_reg(camera_instance, 0x300A, &value)) 
-    {
-      GST_WARNING_OBJECT(src, "Failed to read camera id");
-    }
-    sprintf(src->name+2, "%x", value);
-    if (arducam_read_sensor_reg(camera_instance, 0x300B, &value))
-    {
-      GST_WARNING_OBJECT(src, "Failed to read camera id");
-    }
-    sprintf(src->name+4, "%x", value);
-    src->name[6] = 0;
-    if (arducam_read_sensor_reg(camera_instance, 0x300C, &value))
-    {
-      GST_WARNING_OBJECT(src, "Failed to read revision id");
-    }
-    sprintf(src->revision, "%x", value);
-    src->revision[2] = 0;
-  }
+  src->camera_num = CAMERA_NUM_DEFAULT;
+  src->prewarm = PREWARM_DEFAULT;
+  src->camera.instance = NULL;
+  g_mutex_init (&src->camera.lock);
+  src->secondary_camera_num = SECONDARY_CAMERA_NUM_DEFAULT;
+  src->secondary.instance = NULL;
+  g_mutex_init (&src->secondary.lock);
+  src->pair_tolerance = PAIR_TOLERANCE_DEFAULT;
+  g_mutex_init (&src->pair.lock);
+  g_cond_init (&src->pair.cond);
 
   src->width = WIDTH_DEFAULT;
   src->height = HEIGHT_DEFAULT;
+  src->roi_x = ROI_DEFAULT;
+  src->roi_y = ROI_DEFAULT;
+  src->roi_width = ROI_DEFAULT;
+  src->roi_height = ROI_DEFAULT;
+  src->vblank = VBLANK_LINES_DEFAULT;
+  src->sensor_fps = 0;
+  src->latency = GST_CLOCK_TIME_NONE;
+  src->timestamp_mode = TIMESTAMP_MODE_DEFAULT;
+  src->stats_interval = STATS_INTERVAL_DEFAULT;
+  src->recovery = RECOVERY_DEFAULT;
+  src->max_retries = MAX_RETRIES_DEFAULT;
+  gst_base_src_set_qos_enabled (GST_BASE_SRC (src), QOS_DEFAULT);
+  src->qos_throttle = QOS_THROTTLE_DEFAULT;
+  src->batch_size = BATCH_SIZE_DEFAULT;
+  src->batch_time = BATCH_TIME_DEFAULT;
+  src->qos.earliest_time = GST_CLOCK_TIME_NONE;
+  src->qos.proportion = 1.0;
+  src->qos.ratio = 1.0;
+  src->mode_configured = FALSE;
+  src->output = ARDUCAM_OUTPUT_GRAY8;
+  gst_video_info_set_format (&src->info, GST_VIDEO_FORMAT_GRAY8, 
+    WIDTH_DEFAULT, HEIGHT_DEFAULT);
+  src->frame_size = GST_VIDEO_INFO_SIZE (&src->info);
+  src->stride = GST_VIDEO_INFO_PLANE_STRIDE (&src->info, 0);
+  src->demosaic = DEMOSAIC_DEFAULT;
+  src->demosaic_threads = DEMOSAIC_THREADS_DEFAULT;
   
+  g_mutex_init (&src->config.lock);
+  src->config.sequence = 0;
   src->config.change_flags = 0;
-  src->config.hflip = HFLIP_DEFAULT;
-  src->config.vflip = VFLIP_DEFAULT;
+  src->config.settings.hflip = HFLIP_DEFAULT;
+  src->config.settings.vflip = VFLIP_DEFAULT;
   src->sensor_mode = GST_ARDU_CAM_SRC_SENSOR_MODE_AUTOMATIC;
-  src->config.shutter_speed = SHUTTER_SPEED_DEFAULT;
-  src->config.gain = GST_ARDU_CAM_SRC_GAIN_1X;
-  src->config.external_trigger = EXTERNAL_TRIGGER_DEFAULT;
-  src->config.exposure_mode = EXPOSURE_MODE_DEFAULT;
-  src->config.timeout = TIMEOUT_DEFAULT;
-  src->config.awb = GST_ARDU_CAM_SRC_AWB_1_00X;
+  memcpy (src->modes, sensor_modes, sizeof (src->modes));
+  src->config.settings.shutter_speed = SHUTTER_SPEED_DEFAULT;
+  src->config.settings.gain = GST_ARDU_CAM_SRC_GAIN_1X;
+  src->config.settings.external_trigger = EXTERNAL_TRIGGER_DEFAULT;
+  src->config.settings.exposure_mode = EXPOSURE_MODE_DEFAULT;
+  src->config.settings.timeout = TIMEOUT_DEFAULT;
+  src->config.settings.awb = GST_ARDU_CAM_SRC_AWB_1_00X;
+  src->config.settings.fps_n = 0;
+  src->config.settings.fps_d = 1;
+  src->config.settings.throttle = 1.0;
 
   src->config.change_flags |= PROP_CHANGE_EXPOSURE_MODE;
 
+  src->zero_copy = ZERO_COPY_DEFAULT;
+  src->max_outstanding_buffers = MAX_OUTSTANDING_BUFFERS_DEFAULT;
+  src->outstanding_buffers = 0;
+
+  src->capture_thread = CAPTURE_THREAD_DEFAULT;
+  src->ring_size = RING_SIZE_DEFAULT;
+  src->overflow_policy = GST_ARDU_CAM_SRC_OVERFLOW_POLICY_DROP_OLDEST;
+  g_mutex_init (&src->ring.lock);
+  g_cond_init (&src->ring.cond);
+  g_mutex_init (&src->mode_lock);
+
+  src->async_controls = ASYNC_CONTROLS_DEFAULT;
+  g_mutex_init (&src->control.lock);
+  g_cond_init (&src->control.cond);
+
   GST_LOG_OBJECT (src, "gst_ardu_cam_src_init exit");
 }
 
@@ -512,6 +1460,16 @@ gst_ardu_cam_src_finalize (GObject *object)
   g_return_if_fail (src != NULL);
   g_return_if_fail (GST_IS_ARDUCAMSRC (src));
   GST_LOG_OBJECT (src, "gst_ardu_cam_src_finalize entry");
+  g_mutex_clear (&src->config.lock);
+  g_mutex_clear (&src->ring.lock);
+  g_cond_clear (&src->ring.cond);
+  g_mutex_clear (&src->mode_lock);
+  g_mutex_clear (&src->control.lock);
+  g_cond_clear (&src->control.cond);
+  g_mutex_clear (&src->camera.lock);
+  g_mutex_clear (&src->secondary.lock);
+  g_mutex_clear (&src->pair.lock);
+  g_cond_clear (&src->pair.cond);
   GST_LOG_OBJECT (src, "gst_ardu_cam_src_finalize exit");
   G_OBJECT_CLASS (gst_ardu_cam_src_parent_class)->finalize (object);
 }
@@ -527,66 +1485,165 @@ gst_ardu_cam_src_set_property (GObject * object, guint prop_id,
   
   GST_LOG_OBJECT (src, "gst_ardu_cam_src_set_property entry");
 
-  g_mutex_lock(&src->config.lock);
+  ArduCamSettings *settings = &src->config.settings;
+  ArduCamPropChangeFlags change_flags = 0;
+  gint shutter_speed = -1;
+  CAMERA_INSTANCE instance;
+  gint num;
 
-  switch (prop_id) 
+  // NOTE(marcin.sielski): Query the sensor before entering the write section
+  // so that readers never spin on an SDK call
+  if (prop_id == PROP_EXPOSURE_MODE && !g_value_get_boolean (value) &&
+    (instance = gst_ardu_cam_src_get_instance (src, &num)))
+  {
+    if (arducam_get_control(instance, V4L2_CID_EXPOSURE, &shutter_speed))
+    {
+      GST_WARNING_OBJECT(src, "Failed to get current shutter speed");
+      shutter_speed = -1;
+    }
+    gst_ardu_cam_src_unref_instance (num);
+  }
+
+  gst_ardu_cam_src_config_write_begin (&src->config);
+
+  switch (prop_id) 
   {
     case PROP_HFLIP:
-      src->config.hflip = g_value_get_boolean (value);
-      src->config.change_flags |= PROP_CHANGE_HFLIP;
+      settings->hflip = g_value_get_boolean (value);
+      change_flags |= PROP_CHANGE_HFLIP;
       break;
     case PROP_VFLIP:
-      src->config.vflip = g_value_get_boolean (value);
-      src->config.change_flags |= PROP_CHANGE_VFLIP;
+      settings->vflip = g_value_get_boolean (value);
+      change_flags |= PROP_CHANGE_VFLIP;
       break;
     case PROP_SHUTTER_SPEED:
-      src->config.shutter_speed = g_value_get_int (value);
-      if (src->config.shutter_speed)
+      settings->shutter_speed = g_value_get_int (value);
+      if (settings->shutter_speed)
       {
-        src->config.exposure_mode = FALSE;
-        src->config.change_flags |= PROP_CHANGE_EXPOSURE_MODE;
-        src->config.change_flags |= PROP_CHANGE_SHUTTER_SPEED;
+        settings->exposure_mode = FALSE;
+        change_flags |= PROP_CHANGE_EXPOSURE_MODE;
+        change_flags |= PROP_CHANGE_SHUTTER_SPEED;
       }
       else
       { 
-        src->config.exposure_mode = TRUE;
-        src->config.change_flags |= PROP_CHANGE_EXPOSURE_MODE;
+        settings->exposure_mode = TRUE;
+        change_flags |= PROP_CHANGE_EXPOSURE_MODE;
       }
       break;
     case PROP_GAIN:
-      src->config.gain = g_value_get_enum (value);
-      src->config.change_flags |= PROP_CHANGE_GAIN;
+      settings->gain = g_value_get_enum (value);
+      change_flags |= PROP_CHANGE_GAIN;
       break;
     case PROP_EXTERNAL_TRIGGER:
-      src->config.external_trigger = g_value_get_boolean (value);
-      src->config.change_flags |= PROP_CHANGE_EXTERNAL_TRIGGER;
+      settings->external_trigger = g_value_get_boolean (value);
+      change_flags |= PROP_CHANGE_EXTERNAL_TRIGGER;
       break;
     case PROP_EXPOSURE_MODE:
-      src->config.exposure_mode = g_value_get_boolean (value);
-      src->config.change_flags |= PROP_CHANGE_EXPOSURE_MODE;
-      if (!src->config.exposure_mode)
-      {
-        gint shutter_speed;
-        if (arducam_get_control(
-          camera_instance, V4L2_CID_EXPOSURE, &shutter_speed))
-        {
-          GST_WARNING_OBJECT(src, "Failed to get current shutter speed");
-        }
-        else src->config.shutter_speed = shutter_speed;
-      }
+      settings->exposure_mode = g_value_get_boolean (value);
+      change_flags |= PROP_CHANGE_EXPOSURE_MODE;
+      if (shutter_speed >= 0) settings->shutter_speed = shutter_speed;
       break;
     case PROP_TIMEOUT:
-      src->config.timeout = g_value_get_int (value);
+      settings->timeout = g_value_get_int (value);
       break;
     case PROP_AWB:
-      src->config.awb = g_value_get_enum (value);
-      src->config.change_flags |= PROP_CHANGE_AWB;
+      settings->awb = g_value_get_enum (value);
+      change_flags |= PROP_CHANGE_AWB;
+      break;
+    case PROP_ZERO_COPY:
+      src->zero_copy = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_OUTSTANDING_BUFFERS:
+      src->max_outstanding_buffers = g_value_get_int (value);
+      break;
+    case PROP_CAPTURE_THREAD:
+      src->capture_thread = g_value_get_boolean (value);
+      break;
+    case PROP_RING_SIZE:
+      src->ring_size = g_value_get_int (value);
+      break;
+    case PROP_OVERFLOW_POLICY:
+      src->overflow_policy = g_value_get_enum (value);
+      break;
+    case PROP_ASYNC_CONTROLS:
+      src->async_controls = g_value_get_boolean (value);
+      break;
+    case PROP_DEMOSAIC:
+      src->demosaic = g_value_get_boolean (value);
+      break;
+    case PROP_DEMOSAIC_THREADS:
+      src->demosaic_threads = g_value_get_int (value);
+      break;
+    case PROP_CAMERA_NUM:
+      GST_OBJECT_LOCK (src);
+      if (src->camera.instance)
+      {
+        GST_WARNING_OBJECT (src, "Camera number can not be changed while "
+          "the camera is open");
+      }
+      else src->camera_num = g_value_get_int (value);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_SECONDARY_CAMERA_NUM:
+      GST_OBJECT_LOCK (src);
+      if (src->camera.instance)
+      {
+        GST_WARNING_OBJECT (src, "Secondary camera number can not be changed "
+          "while the camera is open");
+      }
+      else src->secondary_camera_num = g_value_get_int (value);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_PAIR_TOLERANCE:
+      src->pair_tolerance = g_value_get_int (value);
+      break;
+    case PROP_ROI_X:
+      src->roi_x = g_value_get_int (value);
+      break;
+    case PROP_ROI_Y:
+      src->roi_y = g_value_get_int (value);
+      break;
+    case PROP_ROI_WIDTH:
+      src->roi_width = g_value_get_int (value);
+      break;
+    case PROP_ROI_HEIGHT:
+      src->roi_height = g_value_get_int (value);
+      break;
+    case PROP_PREWARM:
+      src->prewarm = g_value_get_boolean (value);
+      break;
+    case PROP_TIMESTAMP_MODE:
+      src->timestamp_mode = g_value_get_enum (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      src->stats_interval = g_value_get_uint (value);
+      break;
+    case PROP_RECOVERY:
+      src->recovery = g_value_get_enum (value);
+      break;
+    case PROP_MAX_RETRIES:
+      src->max_retries = g_value_get_int (value);
+      break;
+    case PROP_QOS:
+      gst_base_src_set_qos_enabled (GST_BASE_SRC (src), 
+        g_value_get_boolean (value));
+      break;
+    case PROP_QOS_THROTTLE:
+      src->qos_throttle = g_value_get_boolean (value);
+      break;
+    case PROP_BATCH_SIZE:
+      src->batch_size = g_value_get_int (value);
+      break;
+    case PROP_BATCH_TIME:
+      src->batch_time = g_value_get_int (value);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
-  g_mutex_unlock (&src->config.lock);
+  gst_ardu_cam_src_config_write_end (&src->config, change_flags);
+
+  if (change_flags) gst_ardu_cam_src_control_wake (src);
 
   GST_LOG_OBJECT (src, "gst_ardu_cam_src_set_property exit");
 }
@@ -602,13 +1659,21 @@ gst_ardu_cam_src_get_property (GObject * object, guint prop_id,
 
   GST_LOG_OBJECT (src, "gst_ardu_cam_src_get_property entry");
 
-  g_mutex_lock (&src->config.lock);
+  ArduCamSettings settings;
+  CAMERA_INSTANCE instance;
+  gint num;
+  gst_ardu_cam_src_config_read (&src->config, &settings);
+
   switch (prop_id) {
     case PROP_SENSOR_NAME:
+      GST_OBJECT_LOCK (src);
       g_value_set_string (value, src->name);
+      GST_OBJECT_UNLOCK (src);
       break;
     case PROP_SENSOR_REVISION:
+      GST_OBJECT_LOCK (src);
       g_value_set_string (value, src->revision);
+      GST_OBJECT_UNLOCK (src);
       break;
     case PROP_WIDTH:
       g_value_set_int (value, src->width);
@@ -620,351 +1685,2895 @@ gst_ardu_cam_src_get_property (GObject * object, guint prop_id,
       g_value_set_enum (value, src->sensor_mode);
       break;
     case PROP_HFLIP:
-      g_value_set_boolean (value, src->config.hflip);
+      g_value_set_boolean (value, settings.hflip);
       break;
     case PROP_VFLIP:
-      g_value_set_boolean (value, src->config.vflip);
+      g_value_set_boolean (value, settings.vflip);
       break;
     case PROP_SHUTTER_SPEED:
-      if (src->config.exposure_mode)
+      if (settings.exposure_mode && 
+        (instance = gst_ardu_cam_src_get_instance (src, &num)))
       {
         gint shutter_speed;
-        if (arducam_get_control(
-          camera_instance, V4L2_CID_EXPOSURE, &shutter_speed))
+        if (arducam_get_control(instance, V4L2_CID_EXPOSURE, &shutter_speed))
         {
           GST_WARNING_OBJECT(src, "Failed to get current shutter speed.");
-          g_value_set_int (value, src->config.shutter_speed);
+          g_value_set_int (value, settings.shutter_speed);
         }
         else g_value_set_int (value, shutter_speed);
+        gst_ardu_cam_src_unref_instance (num);
       }
-      else g_value_set_int (value, src->config.shutter_speed);
+      else g_value_set_int (value, settings.shutter_speed);
       break;
     case PROP_GAIN:
-      g_value_set_enum (value, src->config.gain);
+      g_value_set_enum (value, settings.gain);
       break;
     case PROP_EXTERNAL_TRIGGER:
-      g_value_set_boolean (value, src->config.external_trigger);
+      g_value_set_boolean (value, settings.external_trigger);
       break;
     case PROP_EXPOSURE_MODE:
-      g_value_set_boolean (value, src->config.exposure_mode);
+      g_value_set_boolean (value, settings.exposure_mode);
       break;
     case PROP_TIMEOUT:
-      g_value_set_int (value, src->config.timeout);
+      g_value_set_int (value, settings.timeout);
       break;
     case PROP_AWB:
-      g_value_set_enum (value, src->config.awb);
+      g_value_set_enum (value, settings.awb);
+      break;
+    case PROP_ZERO_COPY:
+      g_value_set_boolean (value, src->zero_copy);
+      break;
+    case PROP_MAX_OUTSTANDING_BUFFERS:
+      g_value_set_int (value, src->max_outstanding_buffers);
+      break;
+    case PROP_POOL_HITS:
+      g_value_set_uint (value, g_atomic_int_get (&src->pool_hits));
+      break;
+    case PROP_POOL_MISSES:
+      g_value_set_uint (value, g_atomic_int_get (&src->pool_misses));
+      break;
+    case PROP_CAPTURE_THREAD:
+      g_value_set_boolean (value, src->capture_thread);
+      break;
+    case PROP_RING_SIZE:
+      g_value_set_int (value, src->ring_size);
+      break;
+    case PROP_OVERFLOW_POLICY:
+      g_value_set_enum (value, src->overflow_policy);
+      break;
+    case PROP_RING_OCCUPANCY:
+      g_value_set_uint (value, (guint) g_atomic_int_get (&src->ring.head) - 
+        (guint) g_atomic_int_get (&src->ring.tail));
+      break;
+    case PROP_RING_DROPS:
+      g_value_set_uint (value, g_atomic_int_get (&src->ring.drops));
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_ardu_cam_src_get_stats (src));
+      break;
+    case PROP_ASYNC_CONTROLS:
+      g_value_set_boolean (value, src->async_controls);
+      break;
+    case PROP_WRITES_ISSUED:
+      g_value_set_uint64 (value, 
+        STATS_GET (src->camera.shadow.writes_issued) + 
+        STATS_GET (src->secondary.shadow.writes_issued));
+      break;
+    case PROP_WRITES_SUPPRESSED:
+      g_value_set_uint64 (value, 
+        STATS_GET (src->camera.shadow.writes_suppressed) + 
+        STATS_GET (src->secondary.shadow.writes_suppressed));
+      break;
+    case PROP_DEMOSAIC:
+      g_value_set_boolean (value, src->demosaic);
+      break;
+    case PROP_DEMOSAIC_THREADS:
+      g_value_set_int (value, src->demosaic_threads);
+      break;
+    case PROP_CAMERA_NUM:
+      GST_OBJECT_LOCK (src);
+      g_value_set_int (value, src->camera_num);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_SECONDARY_CAMERA_NUM:
+      GST_OBJECT_LOCK (src);
+      g_value_set_int (value, src->secondary_camera_num);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_PAIR_TOLERANCE:
+      g_value_set_int (value, src->pair_tolerance);
+      break;
+    case PROP_ROI_X:
+      g_value_set_int (value, src->roi_x);
+      break;
+    case PROP_ROI_Y:
+      g_value_set_int (value, src->roi_y);
+      break;
+    case PROP_ROI_WIDTH:
+      g_value_set_int (value, src->roi_width);
+      break;
+    case PROP_ROI_HEIGHT:
+      g_value_set_int (value, src->roi_height);
+      break;
+    case PROP_PREWARM:
+      g_value_set_boolean (value, src->prewarm);
+      break;
+    case PROP_TIMESTAMP_MODE:
+      g_value_set_enum (value, src->timestamp_mode);
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, src->stats_interval);
+      break;
+    case PROP_RECOVERY:
+      g_value_set_enum (value, src->recovery);
+      break;
+    case PROP_MAX_RETRIES:
+      g_value_set_int (value, src->max_retries);
+      break;
+    case PROP_QOS:
+      g_value_set_boolean (value, 
+        gst_base_src_is_qos_enabled (GST_BASE_SRC (src)));
+      break;
+    case PROP_QOS_THROTTLE:
+      g_value_set_boolean (value, src->qos_throttle);
+      break;
+    case PROP_BATCH_SIZE:
+      g_value_set_int (value, src->batch_size);
+      break;
+    case PROP_BATCH_TIME:
+      g_value_set_int (value, src->batch_time);
+      break;
+    case PROP_TIME_TO_FIRST_BUFFER:
+      g_value_set_int64 (value, gst_ardu_cam_src_time_to_first_buffer (src));
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
-  g_mutex_unlock (&src->config.lock);
   
   GST_LOG_OBJECT (src, "gst_ardu_cam_src_get_property exit");
 }
 
-
-static GstFlowReturn
-gst_ardu_cam_src_create (GstPushSrc * parent, GstBuffer ** buf)
+static guint
+gst_ardu_cam_src_stats_bucket (guint64 value)
 {
-  GstArduCamSrc *src = GST_ARDUCAMSRC (parent);
+  if (value < 16) return value;
+  guint msb = g_bit_storage (value) - 1;
+  guint bucket = (msb - 3) * 16 + ((value >> (msb - 4)) & 15);
+  return MIN (bucket, ARDUCAM_STATS_BUCKETS - 1);
+}
 
-  g_return_val_if_fail (src != NULL, GST_FLOW_ERROR);
-  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), GST_FLOW_ERROR);
+static guint64
+gst_ardu_cam_src_stats_bucket_value (guint bucket)
+{
+  if (bucket < 16) return bucket;
+  guint msb = bucket / 16 + 3;
+  return (guint64) (16 + bucket % 16) << (msb - 4);
+}
 
-  GST_TRACE_OBJECT (src, "gst_ardu_cam_src_create entry");
+static guint64
+gst_ardu_cam_src_stats_percentile (guint * histogram, guint64 total,
+    gdouble percentile)
+{
+  guint64 rank = (guint64) (total * percentile / 100.0);
+  guint64 count = 0;
 
-  g_mutex_lock (&src->config.lock);
-  if (src->config.change_flags)
+  for (guint i = 0; i < ARDUCAM_STATS_BUCKETS; i++)
   {
-    // NOTE(marcin.sielski): Must be called upfront
-    if (src->config.change_flags & PROP_CHANGE_EXTERNAL_TRIGGER)
-    {
-      if (arducam_set_control (camera_instance, V4L2_CID_ARDUCAM_EXT_TRI, 
-        src->config.external_trigger)) 
-      {
-        GST_WARNING_OBJECT (src, "Could not set external trigger mode");
-      }
-    }
-    if (src->config.change_flags & PROP_CHANGE_HFLIP)
-    {
-      if (arducam_set_control (camera_instance, V4L2_CID_HFLIP,
-        src->config.hflip)) 
-      {
-        GST_WARNING_OBJECT (src, "Could not set hflip");
-      }
-    }
-    if (src->config.change_flags & PROP_CHANGE_VFLIP)
-    {
-      if (arducam_set_control (camera_instance, V4L2_CID_VFLIP, 
-        src->config.vflip)) 
-      {
-        GST_WARNING_OBJECT (src, "Could not set vflip");
-      }
-    }
-    //NOTE(marcin.sielski):Exposure Mode shall be set before Shutter Speed
-    //otherwise if shutter speed is set it may be overwrittern by auto mode
-    if (src->config.change_flags & PROP_CHANGE_EXPOSURE_MODE)
-    {
-      if (arducam_software_auto_exposure (camera_instance, 
-        src->config.exposure_mode)) 
-      {
-        GST_WARNING_OBJECT (src, "Could not set auto exposure mode");
-      }
-    }
-    if (src->config.change_flags & PROP_CHANGE_SHUTTER_SPEED)
-    {
-      if (arducam_set_control (camera_instance, V4L2_CID_EXPOSURE, 
-        src->config.shutter_speed)) 
-      {
-        GST_WARNING_OBJECT (src, "Could not set exposure");
-      }
-    }
-    if (src->config.change_flags & PROP_CHANGE_GAIN)
-    {
-      if (arducam_set_control (camera_instance, V4L2_CID_GAIN, 
-        src->config.gain)) 
-      {
-        GST_WARNING_OBJECT (src, "Could not set gain");
-      }
-    }
-    if (src->config.change_flags & PROP_CHANGE_AWB)
-    {
-      if (src->config.awb == -1)
-      {
-        if (arducam_write_sensor_reg(camera_instance, 0x3406, 0x0))
-        {
-          GST_WARNING_OBJECT (src, "Could not enable auto white balance");
-        }
-      }
-      else
-      {
-        //NOTE(marcin.sielski):Manual white balace has to be enabled first
-        if (arducam_write_sensor_reg(camera_instance, 0x3406, 0x1))
-        {
-          GST_WARNING_OBJECT (src, "Could not enable manual white balance");
-        }       
-        if (arducam_write_sensor_reg(camera_instance, 0x3400, src->config.awb))
-        {
-          GST_WARNING_OBJECT (
-            src, "Could not set white balance for red channel");
-        }
-        if (arducam_write_sensor_reg(camera_instance, 0x3402, src->config.awb))
-        {
-          GST_WARNING_OBJECT (
-            src, "Could not set white balance for green channel");
-        }
-        if (arducam_write_sensor_reg(camera_instance, 0x3404, src->config.awb))
-        {
-          GST_WARNING_OBJECT (
-            src, "Could not set white balance for blue channel");
-        }
-      }
-    }
-    src->config.change_flags = 0;
+    count += STATS_BUCKET_GET (histogram[i]);
+    if (count > rank) return gst_ardu_cam_src_stats_bucket_value (i);
   }
+  return 0;
+}
 
-  BUFFER *buffer = arducam_capture(
-    camera_instance, &image_format, src->config.timeout);
+static void
+gst_ardu_cam_src_stats_reset (GstArduCamSrc * src)
+{
+  memset (&src->stats, 0, sizeof (ArduCamStats));
+  src->stats.start_time = g_get_monotonic_time ();
+}
 
-  g_mutex_unlock(&src->config.lock); 
+// NOTE(marcin.sielski): Time between create() calls is spent by the base
+// class pushing the previous buffer or buffer list downstream
+static void
+gst_ardu_cam_src_stats_frame (GstArduCamSrc * src, gint64 begin, gint64 end,
+    guint frames)
+{
+  ArduCamStats *stats = &src->stats;
+  guint64 elapsed = end - begin;
 
-  if (!buffer) {
-    GST_ERROR_OBJECT (src, "Failed to capture frame");
-    return GST_FLOW_ERROR;
-   
+  STATS_ADD (stats->frames, frames);
+  if (!STATS_ADD (stats->creates, 1)) 
+  {
+    STATS_SET (stats->first_buffer_time, end);
   }
-  GstBuffer *gstbuf = gst_buffer_new_allocate (NULL, buffer->length, NULL);
-  gst_buffer_fill (gstbuf, 0, buffer->data, buffer->length);
-  arducam_release_buffer(buffer);
-  *buf = gstbuf;
+  else
+  {
+    gint64 previous = STATS_GET (stats->last_buffer_time);
+    guint64 push = begin > previous ? begin - previous : 0;
+    STATS_ADD (stats->push_time, push);
+    STATS_MAX (stats->push_time_max, push);
+  }
+  STATS_SET (stats->last_buffer_time, end);
+  STATS_BUCKET_ADD (stats->create_time[
+    gst_ardu_cam_src_stats_bucket (elapsed)]);
+  STATS_MAX (stats->create_time_max, elapsed);
+}
 
-  
+// NOTE(marcin.sielski): Live source produces the first frame after PLAYING,
+// the time spent in PAUSED is not counted
+static gint64
+gst_ardu_cam_src_time_to_first_buffer (GstArduCamSrc * src)
+{
+  gint64 first = STATS_GET (src->stats.first_buffer_time);
+  gint64 playing = STATS_GET (src->stats.playing_time);
 
-  return GST_FLOW_OK;
+  if (!first) return -1;
+
+  return first - MAX (playing, src->stats.start_time);
 }
 
-static gboolean
-gst_ardu_cam_src_start (GstBaseSrc * parent)
+// NOTE(marcin.sielski): Exponential moving average over about 8 frames of
+// the time from the SDK returning a frame to the buffer being ready
+static void
+gst_ardu_cam_src_stats_processing (GstArduCamSrc * src, guint64 elapsed)
 {
-  GstArduCamSrc *src = GST_ARDUCAMSRC (parent);
+  guint64 average = STATS_GET (src->stats.processing_time);
 
-  g_return_val_if_fail (src != NULL, FALSE);
-  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), FALSE);  
+  STATS_SET (src->stats.processing_time, 
+    average ? (7 * average + elapsed) / 8 : elapsed);
+  STATS_ADD (src->stats.copy_time, elapsed);
+  STATS_MAX (src->stats.copy_time_max, elapsed);
+}
 
-  GST_LOG_OBJECT (src, "gst_ardu_cam_src_start entry");
+static void
+gst_ardu_cam_src_stats_capture (GstArduCamSrc * src, guint64 elapsed)
+{
+  STATS_ADD (src->stats.captures, 1);
+  STATS_BUCKET_ADD (src->stats.capture_time[
+    gst_ardu_cam_src_stats_bucket (elapsed)]);
+  STATS_MAX (src->stats.capture_time_max, elapsed);
+}
 
-  g_mutex_init (&src->config.lock);
+static GstStructure *
+gst_ardu_cam_src_get_stats (GstArduCamSrc * src)
+{
+  ArduCamStats *stats = &src->stats;
+  guint64 frames = STATS_GET (stats->frames);
+  guint64 creates = STATS_GET (stats->creates);
+  guint64 captures = STATS_GET (stats->captures);
+  guint64 applies = STATS_GET (stats->control_applies);
+  gint64 first = STATS_GET (stats->first_buffer_time);
+  gint64 last = STATS_GET (stats->last_buffer_time);
+  gdouble fps = 0.0;
 
-  GST_LOG_OBJECT (src, "gst_ardu_cam_src_start exit");
+  if (frames > 1 && last > first)
+  {
+    fps = (frames - 1) * (gdouble) G_USEC_PER_SEC / (last - first);
+  }
 
-  return TRUE;
+  return gst_structure_new ("arducamsrc-stats",
+      "sensor-mode", G_TYPE_INT, (gint) src->sensor_mode,
+      "sensor-fps", G_TYPE_DOUBLE, gst_ardu_cam_src_get_sensor_fps (src),
+      "frames", G_TYPE_UINT64, frames,
+      "fps", G_TYPE_DOUBLE, fps,
+      "create-time-p50", G_TYPE_UINT64, 
+        gst_ardu_cam_src_stats_percentile (stats->create_time, creates, 50),
+      "create-time-p90", G_TYPE_UINT64, 
+        gst_ardu_cam_src_stats_percentile (stats->create_time, creates, 90),
+      "create-time-p99", G_TYPE_UINT64, 
+        gst_ardu_cam_src_stats_percentile (stats->create_time, creates, 99),
+      "create-time-max", G_TYPE_UINT64, STATS_GET (stats->create_time_max),
+      "bytes-copied-per-frame", G_TYPE_DOUBLE, frames ? 
+        (gdouble) STATS_GET (stats->bytes_copied) / frames : 0.0,
+      "allocations-per-frame", G_TYPE_DOUBLE, frames ? 
+        (gdouble) STATS_GET (stats->allocations) / frames : 0.0,
+      "time-to-first-buffer", G_TYPE_INT64, 
+        gst_ardu_cam_src_time_to_first_buffer (src),
+      "writes-issued", G_TYPE_UINT64, 
+        STATS_GET (src->camera.shadow.writes_issued) + 
+        STATS_GET (src->secondary.shadow.writes_issued),
+      "writes-suppressed", G_TYPE_UINT64, 
+        STATS_GET (src->camera.shadow.writes_suppressed) + 
+        STATS_GET (src->secondary.shadow.writes_suppressed),
+      "pair-resyncs", G_TYPE_UINT, 
+        (guint) g_atomic_int_get (&src->pair.resyncs),
+      "processing-time", G_TYPE_UINT64, STATS_GET (stats->processing_time),
+      "timestamp-jitter-p50", G_TYPE_UINT64, 
+        gst_ardu_cam_src_stats_percentile (stats->timestamp_jitter, 
+        STATS_GET (stats->timestamped), 50),
+      "timestamp-jitter-p99", G_TYPE_UINT64, 
+        gst_ardu_cam_src_stats_percentile (stats->timestamp_jitter, 
+        STATS_GET (stats->timestamped), 99),
+      "timestamp-jitter-max", G_TYPE_UINT64, 
+        STATS_GET (stats->timestamp_jitter_max),
+      "latency", G_TYPE_UINT64, STATS_GET (src->latency),
+      "mode-switches", G_TYPE_UINT64, STATS_GET (stats->mode_switches),
+      "mode-switch-time", G_TYPE_UINT64, STATS_GET (stats->mode_switch_time),
+      "mode-switch-time-max", G_TYPE_UINT64, 
+        STATS_GET (stats->mode_switch_time_max),
+      "sensor-frames", G_TYPE_UINT64, STATS_GET (stats->sensor_frames),
+      "dropped", G_TYPE_UINT, (guint) g_atomic_int_get (&src->ring.drops),
+      "timeouts", G_TYPE_UINT64, STATS_GET (stats->timeouts),
+      "capture-time-p50", G_TYPE_UINT64, 
+        gst_ardu_cam_src_stats_percentile (stats->capture_time, captures, 50),
+      "capture-time-p90", G_TYPE_UINT64, 
+        gst_ardu_cam_src_stats_percentile (stats->capture_time, captures, 90),
+      "capture-time-p99", G_TYPE_UINT64, 
+        gst_ardu_cam_src_stats_percentile (stats->capture_time, captures, 99),
+      "capture-time-max", G_TYPE_UINT64, STATS_GET (stats->capture_time_max),
+      "copy-time", G_TYPE_UINT64, 
+        captures ? STATS_GET (stats->copy_time) / captures : 0,
+      "copy-time-max", G_TYPE_UINT64, STATS_GET (stats->copy_time_max),
+      "control-applies", G_TYPE_UINT64, applies,
+      "control-apply-time", G_TYPE_UINT64, 
+        applies ? STATS_GET (stats->control_apply_time) / applies : 0,
+      "control-apply-time-max", G_TYPE_UINT64, 
+        STATS_GET (stats->control_apply_time_max),
+      "push-time", G_TYPE_UINT64, 
+        creates > 1 ? STATS_GET (stats->push_time) / (creates - 1) : 0,
+      "push-time-max", G_TYPE_UINT64, STATS_GET (stats->push_time_max),
+      "gaps", G_TYPE_UINT64, STATS_GET (stats->gaps),
+      "recoveries", G_TYPE_UINT64, STATS_GET (stats->recoveries),
+      "recovery-time-max", G_TYPE_UINT64, 
+        STATS_GET (stats->recovery_time_max),
+      "qos-skipped", G_TYPE_UINT64, STATS_GET (stats->qos_skipped),
+      "qos-throttles", G_TYPE_UINT64, STATS_GET (stats->qos_throttles),
+      "frames-per-batch", G_TYPE_DOUBLE, STATS_GET (stats->batches) ? 
+        (gdouble) frames / STATS_GET (stats->batches) : 1.0,
+      NULL);
 }
 
-static gboolean
-gst_ardu_cam_src_stop (GstBaseSrc * parent)
+// NOTE(marcin.sielski): Posted from the streaming thread, the fps of the
+// last interval is added to the cumulative statistics
+static void
+gst_ardu_cam_src_post_stats (GstArduCamSrc * src, gint64 now)
 {
-  GstArduCamSrc *src = GST_ARDUCAMSRC (parent);
+  ArduCamStats *stats = &src->stats;
+  guint interval = src->stats_interval;
 
-  g_return_val_if_fail (src != NULL, FALSE);
-  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), FALSE);   
-
-  GST_LOG_OBJECT (src, "gst_ardu_cam_src_stop entry");
+  if (!interval) return;
+  if (!stats->interval_time)
+  {
+    stats->interval_time = now;
+    stats->interval_frames = STATS_GET (stats->frames);
+    return;
+  }
+  if (now - stats->interval_time < (gint64) interval * 1000) return;
 
-  g_mutex_clear (&src->config.lock);
+  guint64 frames = STATS_GET (stats->frames);
+  GstStructure *structure = gst_ardu_cam_src_get_stats (src);
+  gst_structure_set (structure, "interval-fps", G_TYPE_DOUBLE, 
+    (frames - stats->interval_frames) * (gdouble) G_USEC_PER_SEC / 
+    (now - stats->interval_time), NULL);
+  stats->interval_time = now;
+  stats->interval_frames = frames;
 
-  GST_LOG_OBJECT (src, "gst_ardu_cam_src_stop exit");
- 
-  return TRUE;
+  gst_element_post_message (GST_ELEMENT (src), 
+    gst_message_new_element (GST_OBJECT (src), structure));
 }
 
-static gboolean
-gst_ardu_cam_src_decide_allocation (GstBaseSrc * bsrc, GstQuery * query)
+typedef struct
 {
-  g_return_val_if_fail (bsrc != NULL, FALSE);
- 
-  GST_LOG_OBJECT (bsrc, "In decide_allocation");
- 
-  return GST_BASE_SRC_CLASS (parent_class)->decide_allocation (bsrc, query);
+  GstArduCamSrc *src;
+  gint num;
+  BUFFER *buffer;
 }
+ArduCamBufferWrapper;
 
-
-static GstCaps *
-gst_ardu_cam_src_get_caps (GstBaseSrc * bsrc, GstCaps * filter)
+static void
+gst_ardu_cam_src_release_wrapped (gpointer data)
 {
-  GstCaps *caps;
- 
-  g_return_val_if_fail (bsrc != NULL, FALSE); 
- 
-  GST_LOG_OBJECT (bsrc, "gst_ardu_cam_src_get_caps entry");
- 
-  caps = gst_pad_get_pad_template_caps (GST_BASE_SRC_PAD (bsrc));
-  caps = gst_caps_make_writable (caps);
- 
-  GST_LOG_OBJECT (bsrc, "gst_ardu_cam_src_get_caps exit");
- 
-  return caps;
-}
+  ArduCamBufferWrapper *wrapper = data;
 
+  GST_TRACE_OBJECT (wrapper->src, "Releasing wrapped SDK buffer %p", 
+    wrapper->buffer);
 
-static gboolean
-gst_ardu_cam_src_set_caps (GstBaseSrc * bsrc, GstCaps * caps)
+  arducam_release_buffer (wrapper->buffer);
+  gst_ardu_cam_src_unref_instance (wrapper->num);
+  g_atomic_int_add (&wrapper->src->outstanding_buffers, -1);
+  gst_object_unref (wrapper->src);
+  g_slice_free (ArduCamBufferWrapper, wrapper);
+}
+
+// NOTE(marcin.sielski): Stride of the lines of native output in the SDK 
+// buffers
+static gsize
+gst_ardu_cam_src_sdk_stride (GstArduCamSrc * src)
 {
-  GstArduCamSrc *src = GST_ARDUCAMSRC (bsrc);
-  GstVideoInfo info;
-  GstStructure *structure;
-  const gchar *format = NULL;
+  return SDK_STRIDE (src->output == ARDUCAM_OUTPUT_Y10P ? 
+    ARDUCAM_RAW10_LINE_SIZE (src->width) : src->width);
+}
 
-  g_return_val_if_fail (src != NULL, FALSE);
-  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), FALSE); 
+// NOTE(marcin.sielski): The SDK buffer goes back to the SDK only when
+// downstream drops the last reference to the memory, the camera stays open
+// until then. SDK buffers are padded beyond the frame, only the frame is
+// exposed.
+static GstBuffer *
+gst_ardu_cam_src_wrap_buffer (GstArduCamSrc * src, BUFFER * buffer)
+{
+  ArduCamBufferWrapper *wrapper = g_slice_new (ArduCamBufferWrapper);
+  wrapper->src = gst_object_ref (src);
+  wrapper->num = src->camera.num;
+  wrapper->buffer = buffer;
+  gst_ardu_cam_src_ref_instance (wrapper->num);
+  g_atomic_int_inc (&src->outstanding_buffers);
 
-  GST_LOG_OBJECT (src, "gst_ardu_cam_src_set_caps entry");
+  GstBuffer *gstbuf = gst_buffer_new ();
+  STATS_ADD (src->stats.allocations, 1);
+  gst_buffer_append_memory (gstbuf, 
+    gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, buffer->data, 
+      buffer->length, 0, src->frame_size, wrapper, 
+      gst_ardu_cam_src_release_wrapped));
+  return gstbuf;
+}
 
-  if (!gst_video_info_from_caps (&info, caps)) return FALSE;
+static GstBuffer *
+gst_ardu_cam_src_acquire_buffer (GstArduCamSrc * src, gsize size)
+{
+  GstBuffer *gstbuf = NULL;
+  GstBufferPool *pool = gst_base_src_get_buffer_pool (GST_BASE_SRC (src));
 
-  structure = gst_caps_get_structure (caps, 0);
-  gint sensor_mode_resolution = -1;
-  if (gst_structure_get_int (structure, "height", &src->height)) 
+  if (pool)
   {
-    switch(src->height) 
+    // NOTE(marcin.sielski): Never block the streaming thread on an exhausted
+    // pool, allocate a fresh buffer instead and account it as a miss.
+    GstBufferPoolAcquireParams params = { 0, };
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    if (gst_buffer_pool_acquire_buffer (pool, &gstbuf, &params) != 
+      GST_FLOW_OK)
     {
-      case 100:
-        src->width = 160;
-        sensor_mode_resolution = 4;
-        break;
-      case 200:
-        src->width = 320;
-        sensor_mode_resolution = 3;
-        break;
-      case 400:
-        src->width = 640;
-        sensor_mode_resolution = 2;
-        break;
-      case 720:
-        sensor_mode_resolution = 1;
-      case 800:
-        src->width = 1280;
-        sensor_mode_resolution = 0;
-        break;
-      default:
-        GST_ERROR_OBJECT (src, "Height not supported");
-        return FALSE;
-    }
-    gint width;
-    if (gst_structure_get_int (structure, "width", &width) && 
-      width != src->width) {
-      GST_ERROR_OBJECT (src, "Width not supported");
-      return FALSE;
+      gstbuf = NULL;
     }
+    gst_object_unref (pool);
   }
-  gint sensor_mode = -1;
-  if (gst_structure_get_int (structure, "sensor-mode", &sensor_mode)) {
-    switch(sensor_mode) {
-      case -1:
-        break;
-      case 0:
-      case 5:
-      case 6:
-      case 7:
-      case 11:
-      case 12:
-      case 16:
-      case 21:
-      case 22:
-        if (src->height != 800) return FALSE;
-        break;
-      case 1:
-      case 8:
-      case 13:
-      case 17:
-         if (src->height != 720) return FALSE;
-         break;
-      case 2:
-      case 9:
-      case 14:
-      case 18:
-        if (src->height != 400) return FALSE;
-        break;
-      case 3:
-      case 10:
-      case 15:
-      case 19:
-        if (src->height != 200) return FALSE;
-        break;
-      case 4:
-      case 20:
-        if (src->height != 100) return FALSE;
-        break;
-      default:
-        GST_ERROR_OBJECT (src, "Sensor mode not supported");
-        return FALSE;
-    }
+
+  if (gstbuf)
+  {
+    g_atomic_int_inc (&src->pool_hits);
+  }
+  else
+  {
+    gstbuf = gst_buffer_new_allocate (NULL, size, NULL);
+    g_atomic_int_inc (&src->pool_misses);
+    STATS_ADD (src->stats.allocations, 1);
+  }
+
+  return gstbuf;
+}
+
+// NOTE(marcin.sielski): SDK buffers are padded beyond the frame size, only
+// the negotiated frame is copied whether the buffer comes from the pool or
+// not
+static GstBuffer *
+gst_ardu_cam_src_copy_buffer (GstArduCamSrc * src, BUFFER * buffer)
+{
+  gsize stride = gst_ardu_cam_src_sdk_stride (src);
+  GstBuffer *gstbuf = gst_ardu_cam_src_acquire_buffer (src, src->frame_size);
+  GstMapInfo map;
+
+  if (buffer->length < stride * src->height || 
+    gst_buffer_get_size (gstbuf) < src->frame_size ||
+    !gst_buffer_map (gstbuf, &map, GST_MAP_WRITE))
+  {
+    GST_ERROR_OBJECT (src, "Failed to copy frame");
+    gst_buffer_unref (gstbuf);
+    arducam_release_buffer (buffer);
+    return NULL;
   }
-  format = gst_structure_get_string (structure, "format");
-  if (format && !g_str_equal (format, "GRAY8")) return FALSE;
-  if (sensor_mode != -1) sensor_mode_resolution = sensor_mode;
-  if (sensor_mode_resolution != -1)
+  if (stride == src->stride) memcpy (map.data, buffer->data, src->frame_size);
+  else
   {
-    src->sensor_mode = sensor_mode_resolution;
-    if (arducam_set_mode (camera_instance, src->sensor_mode))
+    for (gint y = 0; y < src->height; y++)
     {
-      GST_ERROR_OBJECT (src, "Could not set sensor mode");
-      return FALSE;
+      memcpy (map.data + y * src->stride, buffer->data + y * stride, 
+        MIN (stride, src->stride));
     }
-    // NOTE(marcin.sielski): For some reason first capture timeouts.
-    BUFFER *buffer = arducam_capture(camera_instance, &image_format, 100);
-    if (buffer) arducam_release_buffer(buffer);
-    if (arducam_set_mode (camera_instance, src->sensor_mode))
+  }
+  gst_buffer_unmap (gstbuf, &map);
+  gst_buffer_set_size (gstbuf, src->frame_size);
+  STATS_ADD (src->stats.bytes_copied, src->frame_size);
+  arducam_release_buffer(buffer);
+
+  return gstbuf;
+}
+
+static gboolean
+gst_ardu_cam_src_output_is_native (ArduCamOutput output)
+{
+  return output == ARDUCAM_OUTPUT_GRAY8 || output == ARDUCAM_OUTPUT_Y10P ||
+    output == ARDUCAM_OUTPUT_BAYER;
+}
+
+static gboolean
+gst_ardu_cam_src_output_is_video (ArduCamOutput output)
+{
+  return output != ARDUCAM_OUTPUT_Y10P && output != ARDUCAM_OUTPUT_BAYER &&
+    output != ARDUCAM_OUTPUT_BAYER10;
+}
+
+static GstBuffer *
+gst_ardu_cam_src_convert_buffer (GstArduCamSrc * src, BUFFER * buffer)
+{
+  gint width = src->width;
+  gint height = src->height;
+  gboolean raw10 = src->output != ARDUCAM_OUTPUT_RGB && 
+    src->output != ARDUCAM_OUTPUT_LUMA;
+  gsize stride = SDK_STRIDE (raw10 ? ARDUCAM_RAW10_LINE_SIZE (width) : width);
+  GstBuffer *gstbuf = gst_ardu_cam_src_acquire_buffer (src, src->frame_size);
+  GstMapInfo map;
+
+  if (buffer->length < stride * height || 
+    !gst_buffer_map (gstbuf, &map, GST_MAP_WRITE))
+  {
+    GST_ERROR_OBJECT (src, "Failed to convert frame");
+    gst_buffer_unref (gstbuf);
+    arducam_release_buffer (buffer);
+    return NULL;
+  }
+  if (raw10)
+  {
+    for (gint y = 0; y < height; y++)
     {
-      GST_ERROR_OBJECT (src, "Could not set sensor mode");
-      return FALSE;
+      const guint8 *line = buffer->data + y * stride;
+      guint8 *out = map.data + y * src->stride;
+      switch (src->output)
+      {
+        case ARDUCAM_OUTPUT_GRAY16_LE:
+          arducam_unpack_raw10_to_gray16 (line, (guint16 *) out, width);
+          break;
+        case ARDUCAM_OUTPUT_GRAY10_LE32:
+          arducam_unpack_raw10_to_gray10_le32 (line, (guint32 *) out, width);
+          break;
+        default:
+          arducam_unpack_raw10_to_bayer16 (line, (guint16 *) out, width);
+          break;
+      }
     }
   }
+  else
+  {
+    arducam_demosaic_process (src->demosaicer, buffer->data, stride, 
+      map.data, src->stride, width, height, 
+      src->output == ARDUCAM_OUTPUT_RGB ? 
+        ARDUCAM_DEMOSAIC_RGB : ARDUCAM_DEMOSAIC_GRAY8);
+  }
+  gst_buffer_unmap (gstbuf, &map);
+  STATS_ADD (src->stats.bytes_copied, src->frame_size);
+  arducam_release_buffer (buffer);
+
+  return gstbuf;
+}
+
+// NOTE(marcin.sielski): Must be called with the camera lock held
+static gint
+gst_ardu_cam_src_set_control (ArduCamCamera * camera, 
+    ArduCamShadowControl index, gint id, gint value)
+{
+  ArduCamShadow *shadow = &camera->shadow;
+  guint mask = 1 << index;
+  gint result;
+
+  if ((shadow->controls_valid & mask) && shadow->controls[index] == value)
+  {
+    STATS_ADD (shadow->writes_suppressed, 1);
+    return 0;
+  }
+
+  if (index == ARDUCAM_SHADOW_AUTO_EXPOSURE)
+  {
+    result = arducam_software_auto_exposure (camera->instance, value);
+  }
+  else
+  {
+    result = arducam_set_control (camera->instance, id, value);
+  }
+  STATS_ADD (shadow->writes_issued, 1);
+
+  shadow->controls_valid &= ~mask;
+  if (result) return result;
+  shadow->controls[index] = value;
+  // NOTE(marcin.sielski): Software auto exposure adjusts exposure and gain on
+  // its own, cache them only while it is known to be disabled
+  if (index == ARDUCAM_SHADOW_AUTO_EXPOSURE && value)
+  {
+    shadow->controls_valid &= ~((1 << ARDUCAM_SHADOW_EXPOSURE) | 
+      (1 << ARDUCAM_SHADOW_GAIN));
+  }
+  if ((index != ARDUCAM_SHADOW_EXPOSURE && index != ARDUCAM_SHADOW_GAIN) ||
+    ((shadow->controls_valid & (1 << ARDUCAM_SHADOW_AUTO_EXPOSURE)) && 
+    !shadow->controls[ARDUCAM_SHADOW_AUTO_EXPOSURE]))
+  {
+    shadow->controls_valid |= mask;
+  }
+
+  return 0;
+}
+
+// NOTE(marcin.sielski): Must be called with the camera lock held
+static void
+gst_ardu_cam_src_shadow_forget (ArduCamCamera * camera, guint16 address)
+{
+  guint i;
+
+  for (i = 0; i < camera->shadow.registers; i++)
+  {
+    if (camera->shadow.addresses[i] == address) 
+    {
+      camera->shadow.registers_valid &= ~(1 << i);
+    }
+  }
+}
+
+// NOTE(marcin.sielski): Must be called with the camera lock held
+static gint
+gst_ardu_cam_src_write_reg (ArduCamCamera * camera, guint16 address, 
+    guint16 value)
+{
+  ArduCamShadow *shadow = &camera->shadow;
+  guint i;
+  gint result;
+
+  for (i = 0; i < shadow->registers; i++)
+  {
+    if (shadow->addresses[i] == address) break;
+  }
+  if (i < shadow->registers && (shadow->registers_valid & (1 << i)) && 
+    shadow->values[i] == value)
+  {
+    STATS_ADD (shadow->writes_suppressed, 1);
+    return 0;
+  }
+  if (i == shadow->registers && i < ARDUCAM_SHADOW_REGISTERS)
+  {
+    shadow->addresses[shadow->registers++] = address;
+  }
+
+  result = arducam_write_sensor_reg (camera->instance, address, value);
+  STATS_ADD (shadow->writes_issued, 1);
+
+  if (i < ARDUCAM_SHADOW_REGISTERS)
+  {
+    shadow->registers_valid &= ~(1 << i);
+    if (!result)
+    {
+      shadow->values[i] = value;
+      shadow->registers_valid |= 1 << i;
+    }
+  }
+
+  return result;
+}
+
+// NOTE(marcin.sielski): Frame length (VTS) in lines producing the requested
+// frame rate at the line time of the mode, never shorter than the lines read
+// out plus vertical blanking. A frame rate of 0 runs the sensor at maximum.
+// QoS throttling stretches the frame by the share of the frame rate kept.
+static gint
+gst_ardu_cam_src_frame_length (GstArduCamSrc * src, 
+    const ArduCamSettings * settings)
+{
+  const ArduCamModeInfo *info = &src->modes[src->sensor_mode];
+  gint lines = gst_ardu_cam_src_roi_enabled (src) ? 
+    src->roi_height : info->height;
+  guint64 length = lines + src->vblank;
+
+  if (settings->fps_n > 0 && settings->fps_d > 0)
+  {
+    guint64 line_rate = (guint64) info->fps * (info->height + src->vblank);
+    length = MAX (length, (line_rate * settings->fps_d + settings->fps_n - 1) /
+      settings->fps_n);
+  }
+  if (settings->throttle > 0.0 && settings->throttle < 1.0)
+  {
+    length = (guint64) (length / settings->throttle + 0.5);
+  }
+
+  return (gint) MIN (length, G_MAXUINT16);
+}
+
+static void
+gst_ardu_cam_src_configure_camera (GstArduCamSrc * src, 
+    ArduCamCamera * camera, guint change_flags, 
+    const ArduCamSettings * settings)
+{
+  g_mutex_lock (&camera->lock);
+
+  // NOTE(marcin.sielski): Must be called upfront
+  if (change_flags & PROP_CHANGE_EXTERNAL_TRIGGER)
+  {
+    if (gst_ardu_cam_src_set_control (camera, ARDUCAM_SHADOW_EXTERNAL_TRIGGER,
+      V4L2_CID_ARDUCAM_EXT_TRI, 
+      settings->external_trigger)) 
+    {
+      GST_WARNING_OBJECT (src, "Could not set external trigger mode");
+    }
+  }
+  // NOTE(marcin.sielski): Frame length bounds the exposure, so it is set 
+  // before shutter speed. Frame rate of ETM modes follows the trigger.
+  if ((change_flags & PROP_CHANGE_FRAMERATE) && src->sensor_mode >= 0 &&
+    !src->modes[src->sensor_mode].etm)
+  {
+    gint frame_length = gst_ardu_cam_src_frame_length (src, settings);
+    if (gst_ardu_cam_src_write_reg (camera, 0x380E, frame_length >> 8) ||
+      gst_ardu_cam_src_write_reg (camera, 0x380F, frame_length & 0xff))
+    {
+      GST_WARNING_OBJECT (src, "Could not set frame length");
+    }
+  }
+  if (change_flags & PROP_CHANGE_HFLIP)
+  {
+    if (gst_ardu_cam_src_set_control (camera, ARDUCAM_SHADOW_HFLIP,
+      V4L2_CID_HFLIP,
+      settings->hflip)) 
+    {
+      GST_WARNING_OBJECT (src, "Could not set hflip");
+    }
+  }
+  if (change_flags & PROP_CHANGE_VFLIP)
+  {
+    if (gst_ardu_cam_src_set_control (camera, ARDUCAM_SHADOW_VFLIP,
+      V4L2_CID_VFLIP, 
+      settings->vflip)) 
+    {
+      GST_WARNING_OBJECT (src, "Could not set vflip");
+    }
+  }
+  //NOTE(marcin.sielski):Exposure Mode shall be set before Shutter Speed
+  //otherwise if shutter speed is set it may be overwrittern by auto mode
+  if (change_flags & PROP_CHANGE_EXPOSURE_MODE)
+  {
+    if (gst_ardu_cam_src_set_control (camera, 
+      ARDUCAM_SHADOW_AUTO_EXPOSURE, 0, settings->exposure_mode)) 
+    {
+      GST_WARNING_OBJECT (src, "Could not set auto exposure mode");
+    }
+  }
+  if (change_flags & PROP_CHANGE_SHUTTER_SPEED)
+  {
+    if (gst_ardu_cam_src_set_control (camera, ARDUCAM_SHADOW_EXPOSURE,
+      V4L2_CID_EXPOSURE, 
+      settings->shutter_speed)) 
+    {
+      GST_WARNING_OBJECT (src, "Could not set exposure");
+    }
+  }
+  if (change_flags & PROP_CHANGE_GAIN)
+  {
+    if (gst_ardu_cam_src_set_control (camera, ARDUCAM_SHADOW_GAIN,
+      V4L2_CID_GAIN, 
+      settings->gain)) 
+    {
+      GST_WARNING_OBJECT (src, "Could not set gain");
+    }
+  }
+  if (change_flags & PROP_CHANGE_AWB)
+  {
+    if (settings->awb == -1)
+    {
+      if (gst_ardu_cam_src_write_reg (camera, 0x3406, 0x0))
+      {
+        GST_WARNING_OBJECT (src, "Could not enable auto white balance");
+      }
+      // NOTE(marcin.sielski): Channel gains are driven by the sensor now
+      gst_ardu_cam_src_shadow_forget (camera, 0x3400);
+      gst_ardu_cam_src_shadow_forget (camera, 0x3402);
+      gst_ardu_cam_src_shadow_forget (camera, 0x3404);
+    }
+    else
+    {
+      //NOTE(marcin.sielski):Manual white balace has to be enabled first
+      if (gst_ardu_cam_src_write_reg (camera, 0x3406, 0x1))
+      {
+        GST_WARNING_OBJECT (src, "Could not enable manual white balance");
+      }       
+      if (gst_ardu_cam_src_write_reg (camera, 0x3400, settings->awb))
+      {
+        GST_WARNING_OBJECT (
+          src, "Could not set white balance for red channel");
+      }
+      if (gst_ardu_cam_src_write_reg (camera, 0x3402, settings->awb))
+      {
+        GST_WARNING_OBJECT (
+          src, "Could not set white balance for green channel");
+      }
+      if (gst_ardu_cam_src_write_reg (camera, 0x3404, settings->awb))
+      {
+        GST_WARNING_OBJECT (
+          src, "Could not set white balance for blue channel");
+      }
+    }
+  }
+  g_mutex_unlock (&camera->lock);
+}
+
+static void
+gst_ardu_cam_src_apply_changes (GstArduCamSrc * src, guint change_flags,
+    const ArduCamSettings * settings, guint64 first_frame)
+{
+  gint64 begin = g_get_monotonic_time ();
+
+  GST_DEBUG_OBJECT (src, "Applying control changes 0x%x", change_flags);
+
+  gst_ardu_cam_src_configure_camera (src, &src->camera, change_flags, 
+    settings);
+  // NOTE(marcin.sielski): Both sensors of a stereo pair share the settings
+  if (src->secondary.instance)
+  {
+    gst_ardu_cam_src_configure_camera (src, &src->secondary, change_flags, 
+      settings);
+  }
+  if ((change_flags & PROP_CHANGE_FRAMERATE) && src->sensor_mode >= 0 &&
+    !src->modes[src->sensor_mode].etm)
+  {
+    gint frame_length = gst_ardu_cam_src_frame_length (src, settings);
+    gdouble fps = gst_ardu_cam_src_mode_fps (&src->modes[src->sensor_mode], 
+      frame_length - src->vblank, src->vblank);
+    gst_ardu_cam_src_set_sensor_fps (src, fps);
+    GST_INFO_OBJECT (src, "Frame length %d lines, sensor runs at %.1f fps",
+      frame_length, fps);
+  }
+  if (change_flags & (PROP_CHANGE_FRAMERATE | PROP_CHANGE_EXTERNAL_TRIGGER))
+  {
+    gst_ardu_cam_src_update_latency (src);
+  }
+
+  // NOTE(marcin.sielski): The streaming thread reads the applied settings
+  // for the buffer meta
+  g_mutex_lock (&src->control.lock);
+  g_atomic_int_inc (&src->control.sequence);
+  src->control.applied = *settings;
+  src->control.generation++;
+  src->control.first_frame = first_frame;
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  g_atomic_int_inc (&src->control.sequence);
+  g_mutex_unlock (&src->control.lock);
+
+  guint64 elapsed = g_get_monotonic_time () - begin;
+  STATS_ADD (src->stats.control_applies, 1);
+  STATS_ADD (src->stats.control_apply_time, elapsed);
+  STATS_MAX (src->stats.control_apply_time_max, elapsed);
+
+  gst_element_post_message (GST_ELEMENT (src), 
+    gst_message_new_element (GST_OBJECT (src), 
+      gst_structure_new ("arducamsrc-settings",
+        "generation", G_TYPE_UINT, src->control.generation,
+        "first-frame", G_TYPE_UINT64, first_frame,
+        "hflip", G_TYPE_BOOLEAN, settings->hflip,
+        "vflip", G_TYPE_BOOLEAN, settings->vflip,
+        "shutter-speed", G_TYPE_INT, settings->shutter_speed,
+        "gain", G_TYPE_INT, (gint) settings->gain,
+        "external-trigger", G_TYPE_BOOLEAN, settings->external_trigger,
+        "exposure-mode", G_TYPE_BOOLEAN, settings->exposure_mode,
+        "awb", G_TYPE_INT, (gint) settings->awb,
+        "framerate", GST_TYPE_FRACTION, settings->fps_n, settings->fps_d,
+        NULL)));
+}
+
+static gpointer
+gst_ardu_cam_src_control_loop (gpointer data)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (data);
+  ArduCamControl *control = &src->control;
+
+  GST_DEBUG_OBJECT (src, "Control thread started");
+
+  g_mutex_lock (&control->lock);
+  while (control->running)
+  {
+    if (!g_atomic_int_get (&src->config.change_flags))
+    {
+      g_cond_wait (&control->cond, &control->lock);
+      continue;
+    }
+    // NOTE(marcin.sielski): Wait for the frame in flight to complete so the
+    // registers are written in the gap between frames, give up waiting if 
+    // the sensor is not streaming.
+    gint frame = g_atomic_int_get (&control->frame);
+    gint64 deadline = g_get_monotonic_time () + CONTROL_FRAME_TIMEOUT;
+    while (control->running && g_atomic_int_get (&control->frame) == frame &&
+      g_cond_wait_until (&control->cond, &control->lock, deadline));
+    if (!control->running) break;
+    g_mutex_unlock (&control->lock);
+
+    guint change_flags = g_atomic_int_and (&src->config.change_flags, 0);
+    ArduCamSettings settings;
+    gst_ardu_cam_src_config_read (&src->config, &settings);
+    // NOTE(marcin.sielski): The frame being exposed while the registers are
+    // written may be affected only partially
+    gst_ardu_cam_src_apply_changes (src, change_flags, &settings, 
+      (guint) g_atomic_int_get (&control->frame) + 1);
+
+    g_mutex_lock (&control->lock);
+  }
+  g_mutex_unlock (&control->lock);
+
+  GST_DEBUG_OBJECT (src, "Control thread stopped");
+
+  return NULL;
+}
+
+static void
+gst_ardu_cam_src_control_thread_start (GstArduCamSrc * src)
+{
+  src->control.running = TRUE;
+  src->control.thread = g_thread_new ("arducamsrc-control", 
+    gst_ardu_cam_src_control_loop, src);
+}
+
+static void
+gst_ardu_cam_src_control_thread_stop (GstArduCamSrc * src)
+{
+  if (!src->control.thread) return;
+
+  g_mutex_lock (&src->control.lock);
+  src->control.running = FALSE;
+  g_cond_signal (&src->control.cond);
+  g_mutex_unlock (&src->control.lock);
+  g_thread_join (src->control.thread);
+  src->control.thread = NULL;
+}
+
+static void
+gst_ardu_cam_src_frame_done (GstArduCamSrc * src)
+{
+  g_atomic_int_inc (&src->control.frame);
+  if (src->control.thread && g_atomic_int_get (&src->config.change_flags))
+  {
+    g_mutex_lock (&src->control.lock);
+    g_cond_signal (&src->control.cond);
+    g_mutex_unlock (&src->control.lock);
+  }
+}
+
+static gpointer
+gst_ardu_cam_src_pair_loop (gpointer data)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (data);
+  ArduCamPair *pair = &src->pair;
+
+  GST_DEBUG_OBJECT (src, "Pair thread started");
+
+  g_mutex_lock (&pair->lock);
+  while (pair->running)
+  {
+    if (pair->completed == pair->requested)
+    {
+      g_cond_wait (&pair->cond, &pair->lock);
+      continue;
+    }
+    gint timeout = pair->timeout;
+    g_mutex_unlock (&pair->lock);
+
+    BUFFER *buffer = arducam_capture (
+      src->secondary.instance, &src->secondary.format, timeout);
+
+    g_mutex_lock (&pair->lock);
+    pair->buffer = buffer;
+    pair->completed++;
+    g_cond_broadcast (&pair->cond);
+  }
+  g_mutex_unlock (&pair->lock);
+
+  GST_DEBUG_OBJECT (src, "Pair thread stopped");
+
+  return NULL;
+}
+
+static void
+gst_ardu_cam_src_pair_thread_start (GstArduCamSrc * src)
+{
+  src->pair.running = TRUE;
+  src->pair.requested = 0;
+  src->pair.completed = 0;
+  src->pair.buffer = NULL;
+  src->pair.thread = g_thread_new ("arducamsrc-pair", 
+    gst_ardu_cam_src_pair_loop, src);
+}
+
+static void
+gst_ardu_cam_src_pair_thread_stop (GstArduCamSrc * src)
+{
+  if (!src->pair.thread) return;
+
+  g_mutex_lock (&src->pair.lock);
+  src->pair.running = FALSE;
+  g_cond_broadcast (&src->pair.cond);
+  g_mutex_unlock (&src->pair.lock);
+  g_thread_join (src->pair.thread);
+  src->pair.thread = NULL;
+
+  if (src->pair.buffer) arducam_release_buffer (src->pair.buffer);
+  src->pair.buffer = NULL;
+}
+
+static void
+gst_ardu_cam_src_pair_request (GstArduCamSrc * src, gint timeout)
+{
+  g_mutex_lock (&src->pair.lock);
+  src->pair.timeout = timeout;
+  src->pair.requested++;
+  g_cond_broadcast (&src->pair.cond);
+  g_mutex_unlock (&src->pair.lock);
+}
+
+static BUFFER *
+gst_ardu_cam_src_pair_wait (GstArduCamSrc * src)
+{
+  BUFFER *buffer;
+
+  g_mutex_lock (&src->pair.lock);
+  while (src->pair.running && src->pair.completed != src->pair.requested)
+  {
+    g_cond_wait (&src->pair.cond, &src->pair.lock);
+  }
+  buffer = src->pair.buffer;
+  src->pair.buffer = NULL;
+  g_mutex_unlock (&src->pair.lock);
+
+  return buffer;
+}
+
+// NOTE(marcin.sielski): Both sensors are triggered by the same pulse, frames
+// are paired when their timestamps are within the pair tolerance. A sensor
+// that missed a pulse delivers an older frame which is dropped and captured
+// again on that sensor only.
+static gboolean
+gst_ardu_cam_src_capture_pair (GstArduCamSrc * src, gint timeout, 
+    BUFFER ** left, BUFFER ** right)
+{
+  BUFFER *primary = NULL;
+  BUFFER *secondary = NULL;
+
+  for (gint attempt = 0; attempt < PAIR_MAX_ATTEMPTS; attempt++)
+  {
+    gboolean requested = !secondary;
+    if (requested) gst_ardu_cam_src_pair_request (src, timeout);
+    if (!primary)
+    {
+      primary = arducam_capture (
+        src->camera.instance, &src->camera.format, timeout);
+    }
+    if (requested) secondary = gst_ardu_cam_src_pair_wait (src);
+    if (!primary || !secondary) break;
+
+    gint64 skew = (gint64) (primary->pts - secondary->pts);
+    if (ABS (skew) <= src->pair_tolerance)
+    {
+      *left = primary;
+      *right = secondary;
+      return TRUE;
+    }
+    GST_DEBUG_OBJECT (src, "Frames %" G_GINT64_FORMAT " us apart, "
+      "resynchronizing", skew);
+    g_atomic_int_inc (&src->pair.resyncs);
+    if (skew < 0)
+    {
+      arducam_release_buffer (primary);
+      primary = NULL;
+    }
+    else
+    {
+      arducam_release_buffer (secondary);
+      secondary = NULL;
+    }
+  }
+  if (primary) arducam_release_buffer (primary);
+  if (secondary) arducam_release_buffer (secondary);
+
+  return FALSE;
+}
+
+// NOTE(marcin.sielski): Lines of the primary and secondary frames are placed
+// side by side
+static GstBuffer *
+gst_ardu_cam_src_join_buffers (GstArduCamSrc * src, BUFFER * left, 
+    BUFFER * right)
+{
+  gsize line = src->output == ARDUCAM_OUTPUT_Y10P ? 
+    ARDUCAM_RAW10_LINE_SIZE (src->width) : (gsize) src->width;
+  gsize stride = SDK_STRIDE (line);
+  gsize size = stride * src->height;
+  GstBuffer *gstbuf = gst_ardu_cam_src_acquire_buffer (src, src->frame_size);
+  GstMapInfo map;
+
+  if (left->length < size || right->length < size ||
+    !gst_buffer_map (gstbuf, &map, GST_MAP_WRITE))
+  {
+    GST_ERROR_OBJECT (src, "Failed to join frames");
+    gst_buffer_unref (gstbuf);
+    gstbuf = NULL;
+  }
+  else
+  {
+    for (gint y = 0; y < src->height; y++)
+    {
+      guint8 *out = map.data + y * src->stride;
+      memcpy (out, left->data + y * stride, line);
+      memcpy (out + line, right->data + y * stride, line);
+    }
+    gst_buffer_unmap (gstbuf, &map);
+    STATS_ADD (src->stats.bytes_copied, 2 * line * src->height);
+  }
+  arducam_release_buffer (left);
+  arducam_release_buffer (right);
+
+  return gstbuf;
+}
+
+// NOTE(marcin.sielski): The offset of the SDK clock to the monotonic clock
+// is the smallest delay between a frame timestamp and its arrival over a 
+// window of frames, which removes scheduling jitter and follows drift of the
+// two clocks. Buffers are stamped with the start of the frame readout, one
+// frame period before the earliest arrival. Offsets count sensor frames,
+// frames the sensor produced but were not captured are skipped unless the
+// sensor is triggered. Every captured frame is accounted for, including the
+// ones skipped afterwards.
+static void
+gst_ardu_cam_src_timestamp (GstArduCamSrc * src, guint64 pts, 
+    gint64 arrival)
+{
+  ArduCamTimestamps *timestamps = &src->timestamps;
+  ArduCamStats *stats = &src->stats;
+  ArduCamSettings settings;
+  gint64 delay = arrival - (gint64) pts;
+  gdouble sensor_fps = gst_ardu_cam_src_get_sensor_fps (src);
+  gdouble period = sensor_fps > 0 ? G_USEC_PER_SEC / sensor_fps : 0;
+
+  gst_ardu_cam_src_config_read (&src->config, &settings);
+  if (timestamps->frames)
+  {
+    guint64 step = 1;
+    if (period > 0 && !settings.external_trigger && src->sensor_mode >= 0 &&
+      !src->modes[src->sensor_mode].etm && pts > timestamps->last_pts)
+    {
+      step = MAX (1, (guint64) ((pts - timestamps->last_pts) / period + 0.5));
+    }
+    timestamps->sequence += step;
+  }
+  timestamps->last_pts = pts;
+  STATS_SET (stats->sensor_frames, timestamps->sequence + 1);
+
+  if (!timestamps->window_frames || delay < timestamps->window_min)
+  {
+    timestamps->window_min = delay;
+  }
+  if (!timestamps->frames || timestamps->window_min < timestamps->offset)
+  {
+    timestamps->offset = timestamps->window_min;
+  }
+  if (++timestamps->window_frames == TIMESTAMP_WINDOW)
+  {
+    timestamps->offset = timestamps->window_min;
+    timestamps->window_frames = 0;
+  }
+  timestamps->frames++;
+
+  guint64 jitter = MAX (delay - timestamps->offset, 0);
+  STATS_ADD (stats->timestamped, 1);
+  STATS_BUCKET_ADD (stats->timestamp_jitter[
+    gst_ardu_cam_src_stats_bucket (jitter)]);
+  STATS_MAX (stats->timestamp_jitter_max, jitter);
+}
+
+// NOTE(marcin.sielski): Stamps the buffer of the frame last timestamped
+static void
+gst_ardu_cam_src_stamp (GstArduCamSrc * src, GstBuffer * gstbuf, guint64 pts)
+{
+  ArduCamTimestamps *timestamps = &src->timestamps;
+  gdouble sensor_fps = gst_ardu_cam_src_get_sensor_fps (src);
+  gdouble period = sensor_fps > 0 ? G_USEC_PER_SEC / sensor_fps : 0;
+
+  GST_BUFFER_OFFSET (gstbuf) = timestamps->sequence;
+  GST_BUFFER_OFFSET_END (gstbuf) = timestamps->sequence + 1;
+
+  if (src->timestamp_mode != GST_ARDU_CAM_SRC_TIMESTAMP_MODE_SENSOR) return;
+  GstClockTime running = gst_ardu_cam_src_running_time (src, 
+    (gint64) pts + timestamps->offset - (gint64) period);
+  if (!GST_CLOCK_TIME_IS_VALID (running)) return;
+  GST_BUFFER_PTS (gstbuf) = running;
+  if (period > 0) GST_BUFFER_DURATION (gstbuf) = period * GST_USECOND;
+}
+
+// NOTE(marcin.sielski): Frame length follows the share of the frame rate 
+// the sensor is throttled to
+static void
+gst_ardu_cam_src_qos_set_ratio (GstArduCamSrc * src, gdouble ratio)
+{
+  src->qos.ratio = ratio;
+  gst_ardu_cam_src_config_write_begin (&src->config);
+  src->config.settings.throttle = ratio;
+  gst_ardu_cam_src_config_write_end (&src->config, PROP_CHANGE_FRAMERATE);
+  gst_ardu_cam_src_control_wake (src);
+}
+
+// NOTE(marcin.sielski): Sustained lateness slows the sensor down by the 
+// proportion downstream is behind, so that the frames it can not keep up 
+// with are neither read out nor transferred, headroom speeds it back up. 
+// Triggered sensors are left alone. Each QoS event is used once so that 
+// reductions do not compound.
+static void
+gst_ardu_cam_src_qos_throttle (GstArduCamSrc * src, guint skipped)
+{
+  ArduCamQos *qos = &src->qos;
+  gdouble sensor_fps = gst_ardu_cam_src_get_sensor_fps (src);
+  ArduCamSettings settings;
+
+  gst_ardu_cam_src_config_read (&src->config, &settings);
+  if (settings.external_trigger || src->sensor_mode < 0 || 
+    src->modes[src->sensor_mode].etm || sensor_fps <= 0)
+  {
+    return;
+  }
+  GST_OBJECT_LOCK (src);
+  gdouble proportion = qos->proportion;
+  qos->proportion = 1.0;
+  GST_OBJECT_UNLOCK (src);
+
+  // NOTE(marcin.sielski): The sensor runs at least at 1 fps
+  gdouble ratio = qos->ratio;
+  if (proportion > 1.0 && skipped > QOS_WINDOW / 2) 
+  {
+    ratio = MAX (ratio / proportion, ratio / sensor_fps);
+  }
+  else if (proportion < 1.0 && !skipped)
+  {
+    ratio = MIN (ratio / proportion, 1.0);
+  }
+  if (ratio == qos->ratio) return;
+
+  GST_INFO_OBJECT (src, "Downstream proportion %.2f, throttling the sensor "
+    "from %.1f to %.1f fps", proportion, sensor_fps, 
+    sensor_fps * ratio / qos->ratio);
+  gst_ardu_cam_src_qos_set_ratio (src, ratio);
+  STATS_ADD (src->stats.qos_throttles, 1);
+}
+
+// NOTE(marcin.sielski): A frame is late when its timestamp is before the 
+// earliest time of the last QoS event. The timestamp is estimated before the
+// frame is copied, from the offset of the frames timestamped so far in 
+// sensor timestamp mode.
+static gboolean
+gst_ardu_cam_src_qos_skip (GstArduCamSrc * src, guint64 pts)
+{
+  ArduCamQos *qos = &src->qos;
+  ArduCamTimestamps *timestamps = &src->timestamps;
+
+  GST_OBJECT_LOCK (src);
+  GstClockTime earliest_time = qos->earliest_time;
+  GST_OBJECT_UNLOCK (src);
+
+  gboolean late = FALSE;
+  GstClockTime running = GST_CLOCK_TIME_NONE;
+  if (GST_CLOCK_TIME_IS_VALID (earliest_time))
+  {
+    gdouble sensor_fps = gst_ardu_cam_src_get_sensor_fps (src);
+    gint64 time = g_get_monotonic_time ();
+    if (src->timestamp_mode == GST_ARDU_CAM_SRC_TIMESTAMP_MODE_SENSOR && 
+      timestamps->frames && sensor_fps > 0)
+    {
+      time = (gint64) pts + timestamps->offset - 
+        (gint64) (G_USEC_PER_SEC / sensor_fps);
+    }
+    running = gst_ardu_cam_src_running_time (src, time);
+    late = GST_CLOCK_TIME_IS_VALID (running) && running <= earliest_time;
+  }
+
+  if (late) qos->skipped++;
+  if (++qos->frames == QOS_WINDOW)
+  {
+    if (src->qos_throttle) gst_ardu_cam_src_qos_throttle (src, qos->skipped);
+    qos->frames = 0;
+    qos->skipped = 0;
+  }
+  if (late)
+  {
+    GST_LOG_OBJECT (src, "Skipping frame at %" GST_TIME_FORMAT ", earliest "
+      "time %" GST_TIME_FORMAT, GST_TIME_ARGS (running), 
+      GST_TIME_ARGS (earliest_time));
+    STATS_ADD (src->stats.qos_skipped, 1);
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+gst_ardu_cam_src_qos_reset (GstArduCamSrc * src)
+{
+  GST_OBJECT_LOCK (src);
+  src->qos.earliest_time = GST_CLOCK_TIME_NONE;
+  src->qos.proportion = 1.0;
+  GST_OBJECT_UNLOCK (src);
+  src->qos.frames = 0;
+  src->qos.skipped = 0;
+  if (src->qos.ratio != 1.0) gst_ardu_cam_src_qos_set_ratio (src, 1.0);
+}
+
+static void
+gst_ardu_cam_src_add_meta (GstArduCamSrc * src, GstBuffer * gstbuf, 
+  gint64 started, gint64 captured, guint32 length)
+{
+  // NOTE(marcin.sielski): The frame counter was already advanced for this
+  // frame
+  guint64 frame = (guint) g_atomic_int_get (&src->control.frame) - 1;
+
+  GstArduCamMeta *meta = gst_buffer_add_ardu_cam_meta (gstbuf);
+  meta->camera_num = src->camera.num;
+  meta->sensor_mode = src->sensor_mode;
+  meta->sequence = src->timestamps.sequence;
+  meta->capture_start = started;
+  meta->capture_end = captured;
+  meta->length = length;
+
+  ArduCamSettings applied;
+  guint generation;
+  guint64 first_frame;
+  gint sequence;
+  do
+  {
+    while ((sequence = g_atomic_int_get (&src->control.sequence)) & 1);
+    applied = src->control.applied;
+    generation = src->control.generation;
+    first_frame = src->control.first_frame;
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  }
+  while (g_atomic_int_get (&src->control.sequence) != sequence);
+  meta->generation = generation;
+  meta->transition = frame < first_frame;
+  meta->hflip = applied.hflip;
+  meta->vflip = applied.vflip;
+  meta->shutter_speed = applied.shutter_speed;
+  meta->gain = (gint) applied.gain;
+  meta->external_trigger = applied.external_trigger;
+  meta->exposure_mode = applied.exposure_mode;
+  meta->awb = (gint) applied.awb;
+  meta->fps_n = applied.fps_n;
+  meta->fps_d = applied.fps_d;
+}
+
+static void
+gst_ardu_cam_src_capture_frame (GstArduCamSrc * src, gint timeout, 
+    BUFFER ** buffer, BUFFER ** peer)
+{
+  if (src->secondary.instance)
+  {
+    gst_ardu_cam_src_capture_pair (src, timeout, buffer, peer);
+  }
+  else
+  {
+    *buffer = arducam_capture(
+      src->camera.instance, &src->camera.format, timeout);
+  }
+}
+
+static void
+gst_ardu_cam_src_reapply_settings (GstArduCamSrc * src)
+{
+  ArduCamSettings settings;
+
+  gst_ardu_cam_src_config_read (&src->config, &settings);
+  gst_ardu_cam_src_apply_changes (src, PROP_CHANGE_ALL, &settings, 
+    (guint) g_atomic_int_get (&src->control.frame));
+}
+
+// NOTE(marcin.sielski): Sets the sensor mode again including the warm-up 
+// the SDK needs after open, this restarts streaming
+static gboolean
+gst_ardu_cam_src_reset_mode (GstArduCamSrc * src)
+{
+  gboolean reset = FALSE;
+
+  g_mutex_lock (&src->mode_lock);
+  if (src->sensor_mode >= 0)
+  {
+    g_mutex_lock (&src->camera.lock);
+    src->camera.warm = FALSE;
+    g_mutex_unlock (&src->camera.lock);
+    g_mutex_lock (&src->secondary.lock);
+    src->secondary.warm = FALSE;
+    g_mutex_unlock (&src->secondary.lock);
+    reset = gst_ardu_cam_src_switch_mode (src, src->sensor_mode);
+    if (reset) gst_ardu_cam_src_reapply_settings (src);
+  }
+  g_mutex_unlock (&src->mode_lock);
+
+  return reset;
+}
+
+// NOTE(marcin.sielski): Waits on the ring, unlock and stop interrupt the 
+// wait. Returns FALSE when interrupted.
+static gboolean
+gst_ardu_cam_src_recovery_wait (GstArduCamSrc * src, gint64 delay)
+{
+  ArduCamRing *ring = &src->ring;
+  gint64 end_time = g_get_monotonic_time () + delay;
+  gboolean interrupted;
+
+  g_mutex_lock (&ring->lock);
+  while (!(interrupted = g_atomic_int_get (&ring->flushing) || 
+    g_atomic_int_get (&ring->stopping)) && 
+    g_cond_wait_until (&ring->cond, &ring->lock, end_time));
+  g_mutex_unlock (&ring->lock);
+
+  return !interrupted;
+}
+
+// NOTE(marcin.sielski): Threads using the camera instances are stopped while
+// the cameras are reopened. A camera still referenced by wrapped frames would
+// be taken over as is, so they are given a moment to be released first and
+// the sensor mode is reset instead when they are not. Sets reopened when the
+// cameras were reinitialized.
+static gboolean
+gst_ardu_cam_src_reopen (GstArduCamSrc * src, gboolean * reopened)
+{
+  gboolean control = src->control.thread != NULL;
+  gboolean opened = FALSE;
+
+  *reopened = FALSE;
+  for (gint64 waited = 0; waited < RECOVERY_DRAIN && 
+    g_atomic_int_get (&src->outstanding_buffers); 
+    waited += RECOVERY_DRAIN_STEP)
+  {
+    if (!gst_ardu_cam_src_recovery_wait (src, RECOVERY_DRAIN_STEP)) 
+    {
+      return FALSE;
+    }
+  }
+  if (gst_ardu_cam_src_instance_shared (&src->camera) || 
+    gst_ardu_cam_src_instance_shared (&src->secondary))
+  {
+    GST_WARNING_OBJECT (src, "Camera is still referenced by buffers, "
+      "resetting the sensor mode instead of reopening");
+    return gst_ardu_cam_src_reset_mode (src);
+  }
+
+  g_mutex_lock (&src->mode_lock);
+  gint sensor_mode = src->sensor_mode;
+  if (sensor_mode >= 0)
+  {
+    gst_ardu_cam_src_control_thread_stop (src);
+    gst_ardu_cam_src_pair_thread_stop (src);
+    gst_ardu_cam_src_close (src);
+    opened = gst_ardu_cam_src_open (src) && 
+      gst_ardu_cam_src_switch_mode (src, sensor_mode);
+    if (opened) gst_ardu_cam_src_reapply_settings (src);
+    if (src->secondary.instance) gst_ardu_cam_src_pair_thread_start (src);
+    if (control) gst_ardu_cam_src_control_thread_start (src);
+  }
+  g_mutex_unlock (&src->mode_lock);
+  *reopened = opened;
+
+  return opened;
+}
+
+// NOTE(marcin.sielski): The SDK reports both a timeout and a failure as a 
+// missing buffer, a capture call lasting the whole timeout is a timeout. 
+// Triggered sensors time out whenever the trigger pauses, which is a gap in
+// the stream rather than a failure.
+static GstFlowReturn
+gst_ardu_cam_src_recover (GstArduCamSrc * src, 
+    const ArduCamSettings * settings, gint64 started, BUFFER ** buffer, 
+    BUFFER ** peer)
+{
+  gint64 elapsed = g_get_monotonic_time () - started;
+
+  if (src->recovery == GST_ARDU_CAM_SRC_RECOVERY_ERROR)
+  {
+    GST_ERROR_OBJECT (src, "Failed to capture frame");
+    return GST_FLOW_ERROR;
+  }
+  if ((settings->external_trigger || (src->sensor_mode >= 0 && 
+    src->modes[src->sensor_mode].etm)) && 
+    elapsed >= (gint64) settings->timeout * 1000)
+  {
+    STATS_ADD (src->stats.gaps, 1);
+    GST_DEBUG_OBJECT (src, "No trigger within %d ms", settings->timeout);
+    return ARDUCAM_FLOW_GAP;
+  }
+
+  GST_WARNING_OBJECT (src, "Failed to capture frame, recovering");
+  for (gint attempt = 1; attempt <= src->max_retries; attempt++)
+  {
+    gint64 backoff = MIN ((gint64) RECOVERY_BACKOFF << (attempt - 1), 
+      RECOVERY_BACKOFF_MAX);
+    if (!gst_ardu_cam_src_recovery_wait (src, backoff)) 
+    {
+      return GST_FLOW_FLUSHING;
+    }
+    // NOTE(marcin.sielski): Resetting the sensor mode is cheaper, the camera
+    // is reopened when it did not help
+    gboolean reopened = FALSE;
+    gboolean reset = attempt == 1 ? gst_ardu_cam_src_reset_mode (src) : 
+      gst_ardu_cam_src_reopen (src, &reopened);
+    if (!reset) continue;
+    gst_ardu_cam_src_capture_frame (src, settings->timeout, buffer, peer);
+    if (!*buffer) continue;
+
+    elapsed = g_get_monotonic_time () - started;
+    STATS_ADD (src->stats.recoveries, 1);
+    STATS_MAX (src->stats.recovery_time_max, elapsed);
+    gchar *debug = g_strdup_printf ("%s on attempt %d, %" G_GINT64_FORMAT 
+      " us without frames", reopened ? "Camera reopened" : 
+      "Sensor mode reset", attempt, elapsed);
+    GST_WARNING_OBJECT (src, "Recovered from capture failure: %s", debug);
+    GError *error = g_error_new_literal (GST_RESOURCE_ERROR, 
+      GST_RESOURCE_ERROR_READ, "Recovered from capture failure");
+    gst_element_post_message (GST_ELEMENT (src), 
+      gst_message_new_warning (GST_OBJECT (src), error, debug));
+    g_error_free (error);
+    g_free (debug);
+    return GST_FLOW_OK;
+  }
+
+  GST_ERROR_OBJECT (src, "Failed to capture frame after %d attempts", 
+    src->max_retries);
+
+  return GST_FLOW_ERROR;
+}
+
+static GstFlowReturn
+gst_ardu_cam_src_capture (GstArduCamSrc * src, GstBuffer ** buf)
+{
+  // NOTE(marcin.sielski): Consume pending changes before taking the settings
+  // snapshot, a concurrent update then raises its flag again for next frame
+  ArduCamSettings settings;
+  guint change_flags = 0;
+  if (!src->control.thread)
+  {
+    change_flags = g_atomic_int_and (&src->config.change_flags, 0);
+  }
+  gst_ardu_cam_src_config_read (&src->config, &settings);
+
+  if (change_flags)
+  {
+    gst_ardu_cam_src_apply_changes (src, change_flags, &settings, 
+      (guint) g_atomic_int_get (&src->control.frame));
+  }
+
+  BUFFER *buffer = NULL;
+  BUFFER *peer = NULL;
+  gint64 started = g_get_monotonic_time ();
+  gst_ardu_cam_src_capture_frame (src, settings.timeout, &buffer, &peer);
+  if (!buffer)
+  {
+    STATS_ADD (src->stats.timeouts, 1);
+    GstFlowReturn flow = gst_ardu_cam_src_recover (src, &settings, started, 
+      &buffer, &peer);
+    if (flow != GST_FLOW_OK) return flow;
+  }
+
+  // NOTE(marcin.sielski): Converted formats are always written into a new
+  // buffer, the SDK buffer is released right away. Frames are wrapped only
+  // when their lines are laid out as negotiated.
+  gboolean convert = !gst_ardu_cam_src_output_is_native (src->output);
+  gboolean zero_copy = src->zero_copy && !convert && !peer &&
+    buffer->length >= src->frame_size && 
+    gst_ardu_cam_src_sdk_stride (src) == src->stride &&
+    g_atomic_int_get (&src->outstanding_buffers) < 
+    src->max_outstanding_buffers;
+
+  gst_ardu_cam_src_frame_done (src);
+  gint64 captured = g_get_monotonic_time ();
+  gst_ardu_cam_src_stats_capture (src, captured - started);
+  gst_ardu_cam_src_timestamp (src, buffer->pts, captured);
+  if (gst_ardu_cam_src_qos_skip (src, buffer->pts))
+  {
+    arducam_release_buffer (buffer);
+    if (peer) arducam_release_buffer (peer);
+    return ARDUCAM_FLOW_SKIP;
+  }
+  guint64 pts = buffer->pts;
+  guint32 length = buffer->length;
+  GstBuffer *gstbuf;
+  if (peer)
+  {
+    gstbuf = gst_ardu_cam_src_join_buffers (src, buffer, peer);
+    if (!gstbuf) return GST_FLOW_ERROR;
+  }
+  else if (zero_copy)
+  {
+    gstbuf = gst_ardu_cam_src_wrap_buffer (src, buffer);
+  }
+  else if (convert)
+  {
+    gstbuf = gst_ardu_cam_src_convert_buffer (src, buffer);
+    if (!gstbuf) return GST_FLOW_ERROR;
+  }
+  else
+  {
+    gstbuf = gst_ardu_cam_src_copy_buffer (src, buffer);
+    if (!gstbuf) return GST_FLOW_ERROR;
+  }
+  gst_ardu_cam_src_stats_processing (src, g_get_monotonic_time () - captured);
+  gst_ardu_cam_src_stamp (src, gstbuf, pts);
+  gst_ardu_cam_src_add_meta (src, gstbuf, started, captured, length);
+  *buf = gstbuf;
+
+  return GST_FLOW_OK;
+}
+
+static void
+gst_ardu_cam_src_ring_wake (ArduCamRing * ring)
+{
+  if (g_atomic_int_get (&ring->waiting))
+  {
+    g_mutex_lock (&ring->lock);
+    g_cond_broadcast (&ring->cond);
+    g_mutex_unlock (&ring->lock);
+  }
+}
+
+static GstBuffer *
+gst_ardu_cam_src_ring_take (ArduCamRing * ring)
+{
+  for (;;)
+  {
+    guint tail = g_atomic_int_get (&ring->tail);
+    if ((guint) g_atomic_int_get (&ring->head) == tail) return NULL;
+    GstBuffer *gstbuf = g_atomic_pointer_get (
+      &ring->slots[tail & (ring->size - 1)]);
+    // NOTE(marcin.sielski): The capture thread may have dropped this slot
+    // under the drop-oldest policy, in which case retry with the next one.
+    if (g_atomic_int_compare_and_exchange (&ring->tail, tail, tail + 1))
+    {
+      gst_ardu_cam_src_ring_wake (ring);
+      return gstbuf;
+    }
+  }
+}
+
+static void
+gst_ardu_cam_src_ring_push (GstArduCamSrc * src, GstBuffer * gstbuf)
+{
+  ArduCamRing *ring = &src->ring;
+
+  for (;;)
+  {
+    guint head = g_atomic_int_get (&ring->head);
+    if (head - (guint) g_atomic_int_get (&ring->tail) < ring->size)
+    {
+      g_atomic_pointer_set (&ring->slots[head & (ring->size - 1)], gstbuf);
+      g_atomic_int_set (&ring->head, head + 1);
+      gst_ardu_cam_src_ring_wake (ring);
+      return;
+    }
+    switch (src->overflow_policy)
+    {
+      case GST_ARDU_CAM_SRC_OVERFLOW_POLICY_DROP_OLDEST:
+      {
+        GstBuffer *oldest = gst_ardu_cam_src_ring_take (ring);
+        if (oldest)
+        {
+          gst_buffer_unref (oldest);
+          g_atomic_int_inc (&ring->drops);
+        }
+        break;
+      }
+      case GST_ARDU_CAM_SRC_OVERFLOW_POLICY_DROP_NEWEST:
+        gst_buffer_unref (gstbuf);
+        g_atomic_int_inc (&ring->drops);
+        return;
+      case GST_ARDU_CAM_SRC_OVERFLOW_POLICY_BLOCK:
+        g_mutex_lock (&ring->lock);
+        g_atomic_int_inc (&ring->waiting);
+        while (!g_atomic_int_get (&ring->stopping) && 
+          (guint) g_atomic_int_get (&ring->head) - 
+          (guint) g_atomic_int_get (&ring->tail) >= ring->size)
+        {
+          g_cond_wait (&ring->cond, &ring->lock);
+        }
+        g_atomic_int_add (&ring->waiting, -1);
+        g_mutex_unlock (&ring->lock);
+        if (g_atomic_int_get (&ring->stopping))
+        {
+          gst_buffer_unref (gstbuf);
+          return;
+        }
+        break;
+    }
+  }
+}
+
+static GstFlowReturn
+gst_ardu_cam_src_ring_pop (GstArduCamSrc * src, GstBuffer ** buf)
+{
+  ArduCamRing *ring = &src->ring;
+
+  for (;;)
+  {
+    GstBuffer *gstbuf = gst_ardu_cam_src_ring_take (ring);
+    if (gstbuf)
+    {
+      *buf = gstbuf;
+      return GST_FLOW_OK;
+    }
+    if (g_atomic_int_get (&ring->flushing)) return GST_FLOW_FLUSHING;
+    GstFlowReturn flow = g_atomic_int_get (&ring->flow);
+    if (flow != GST_FLOW_OK) return flow;
+    // NOTE(marcin.sielski): Gaps follow the frames captured before them
+    if (g_atomic_int_get (&ring->gaps))
+    {
+      g_atomic_int_add (&ring->gaps, -1);
+      return ARDUCAM_FLOW_GAP;
+    }
+
+    g_mutex_lock (&ring->lock);
+    g_atomic_int_inc (&ring->waiting);
+    while (g_atomic_int_get (&ring->head) == g_atomic_int_get (&ring->tail) &&
+      !g_atomic_int_get (&ring->gaps) && !g_atomic_int_get (&ring->flushing) &&
+      
+      g_atomic_int_get (&ring->flow) == GST_FLOW_OK)
+    {
+      g_cond_wait (&ring->cond, &ring->lock);
+    }
+    g_atomic_int_add (&ring->waiting, -1);
+    g_mutex_unlock (&ring->lock);
+  }
+}
+
+static gpointer
+gst_ardu_cam_src_capture_loop (gpointer data)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (data);
+  ArduCamRing *ring = &src->ring;
+
+  GST_DEBUG_OBJECT (src, "Capture thread started");
+
+  while (!g_atomic_int_get (&ring->stopping))
+  {
+    GstBuffer *gstbuf = NULL;
+    GstFlowReturn flow = gst_ardu_cam_src_capture (src, &gstbuf);
+    if (flow == ARDUCAM_FLOW_GAP)
+    {
+      g_atomic_int_inc (&ring->gaps);
+      gst_ardu_cam_src_ring_wake (ring);
+      continue;
+    }
+    if (flow == ARDUCAM_FLOW_SKIP) continue;
+    if (flow != GST_FLOW_OK)
+    {
+      // NOTE(marcin.sielski): Hand the error over to the streaming thread
+      g_mutex_lock (&ring->lock);
+      g_atomic_int_set (&ring->flow, flow);
+      g_cond_broadcast (&ring->cond);
+      g_mutex_unlock (&ring->lock);
+      break;
+    }
+    gst_ardu_cam_src_ring_push (src, gstbuf);
+  }
+
+  GST_DEBUG_OBJECT (src, "Capture thread stopped");
+
+  return NULL;
+}
+
+static void
+gst_ardu_cam_src_capture_thread_start (GstArduCamSrc * src)
+{
+  ArduCamRing *ring = &src->ring;
+
+  ring->size = 1;
+  while (ring->size < (guint) src->ring_size) ring->size <<= 1;
+  ring->slots = g_new0 (GstBuffer *, ring->size);
+  ring->head = 0;
+  ring->tail = 0;
+  ring->drops = 0;
+  ring->gaps = 0;
+  ring->stopping = FALSE;
+  ring->flow = GST_FLOW_OK;
+  ring->thread = g_thread_new ("arducamsrc-capture", 
+    gst_ardu_cam_src_capture_loop, src);
+}
+
+static void
+gst_ardu_cam_src_capture_thread_stop (GstArduCamSrc * src)
+{
+  ArduCamRing *ring = &src->ring;
+  GstBuffer *gstbuf;
+
+  if (!ring->thread) return;
+
+  g_mutex_lock (&ring->lock);
+  g_atomic_int_set (&ring->stopping, TRUE);
+  g_cond_broadcast (&ring->cond);
+  g_mutex_unlock (&ring->lock);
+  g_thread_join (ring->thread);
+  ring->thread = NULL;
+
+  while ((gstbuf = gst_ardu_cam_src_ring_take (ring))) 
+  {
+    gst_buffer_unref (gstbuf);
+  }
+  g_free (ring->slots);
+  ring->slots = NULL;
+}
+
+// NOTE(marcin.sielski): Lets downstream waiting on the source, e.g. a muxer,
+// progress while the sensor is not triggered
+static void
+gst_ardu_cam_src_push_gap (GstArduCamSrc * src)
+{
+  ArduCamSettings settings;
+
+  gst_ardu_cam_src_config_read (&src->config, &settings);
+  GstClock *clock = gst_element_get_clock (GST_ELEMENT (src));
+  if (!clock) return;
+  GstClockTime duration = settings.timeout * GST_MSECOND;
+  GstClockTime now = gst_clock_get_time (clock);
+  GstClockTime base_time = gst_element_get_base_time (GST_ELEMENT (src));
+  GstClockTime start = now > base_time + duration ? 
+    now - base_time - duration : 0;
+  gst_object_unref (clock);
+
+  gst_pad_push_event (GST_BASE_SRC_PAD (src), 
+    gst_event_new_gap (start, duration));
+}
+
+static GstFlowReturn
+gst_ardu_cam_src_next_frame (GstArduCamSrc * src, GstBuffer ** buf)
+{
+  GstFlowReturn flow;
+
+  for (;;)
+  {
+    if (src->capture_thread)
+    {
+      // NOTE(marcin.sielski): Started lazily so that the sensor mode is 
+      // already configured by set_caps when the first frame is captured
+      if (!src->ring.thread) gst_ardu_cam_src_capture_thread_start (src);
+      flow = gst_ardu_cam_src_ring_pop (src, buf);
+    }
+    else flow = gst_ardu_cam_src_capture (src, buf);
+    if (flow == ARDUCAM_FLOW_GAP) gst_ardu_cam_src_push_gap (src);
+    else if (flow != ARDUCAM_FLOW_SKIP) break;
+    if (g_atomic_int_get (&src->ring.flushing))
+    {
+      flow = GST_FLOW_FLUSHING;
+      break;
+    }
+  }
+
+  return flow;
+}
+
+#if GST_CHECK_VERSION (1, 14, 0)
+// NOTE(marcin.sielski): Frames of a batch are pushed downstream as a single
+// buffer list, collecting stops when the next frame would exceed the time 
+// budget. The base class timestamps only the first buffer of a list, so
+// frames are stamped on arrival here. A flow other than OK ends the batch,
+// the frames collected so far are still submitted.
+static GstFlowReturn
+gst_ardu_cam_src_batch (GstArduCamSrc * src, GstBuffer ** buf, 
+    guint * frames)
+{
+  GstBufferList *list = gst_buffer_list_new_sized (src->batch_size);
+  gint64 deadline = g_get_monotonic_time () + src->batch_time;
+  gdouble sensor_fps = gst_ardu_cam_src_get_sensor_fps (src);
+  gint64 period = sensor_fps > 0 ? (gint64) (G_USEC_PER_SEC / sensor_fps) : 0;
+  GstBuffer *gstbuf = *buf;
+  GstFlowReturn flow = GST_FLOW_OK;
+
+  for (;;)
+  {
+    if (!GST_CLOCK_TIME_IS_VALID (GST_BUFFER_PTS (gstbuf)))
+    {
+      GST_BUFFER_PTS (gstbuf) = gst_ardu_cam_src_running_time (src, 
+        g_get_monotonic_time ());
+    }
+    gst_buffer_list_add (list, gstbuf);
+    if ((gint) gst_buffer_list_length (list) >= src->batch_size ||
+      (src->batch_time && g_get_monotonic_time () + period > deadline))
+    {
+      break;
+    }
+    flow = gst_ardu_cam_src_next_frame (src, &gstbuf);
+    if (flow != GST_FLOW_OK) break;
+  }
+  *buf = NULL;
+  src->batch_flow = flow;
+  *frames = gst_buffer_list_length (list);
+
+  STATS_ADD (src->stats.batches, 1);
+  gst_base_src_submit_buffer_list (GST_BASE_SRC (src), list);
+
+  return GST_FLOW_OK;
+}
+#endif
+
+static GstFlowReturn
+gst_ardu_cam_src_create (GstPushSrc * parent, GstBuffer ** buf)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (parent);
+
+  g_return_val_if_fail (src != NULL, GST_FLOW_ERROR);
+  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), GST_FLOW_ERROR);
+
+  GST_TRACE_OBJECT (src, "gst_ardu_cam_src_create entry");
+
+  gint64 begin = g_get_monotonic_time ();
+  guint frames = 1;
+  GstFlowReturn flow = src->batch_flow;
+  if (flow != GST_FLOW_OK)
+  {
+    src->batch_flow = GST_FLOW_OK;
+    return flow;
+  }
+  flow = gst_ardu_cam_src_next_frame (src, buf);
+#if GST_CHECK_VERSION (1, 14, 0)
+  if (flow == GST_FLOW_OK && src->batch_size > 1)
+  {
+    flow = gst_ardu_cam_src_batch (src, buf, &frames);
+  }
+#endif
+
+  if (flow == GST_FLOW_OK) 
+  {
+    gint64 end = g_get_monotonic_time ();
+    gst_ardu_cam_src_stats_frame (src, begin, end, frames);
+    gst_ardu_cam_src_update_latency (src);
+    gst_ardu_cam_src_post_stats (src, end);
+  }
+
+  return flow;
+}
+
+static GstStateChangeReturn
+gst_ardu_cam_src_change_state (GstElement * element, 
+    GstStateChange transition)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (element);
+  GstStateChangeReturn ret;
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_change_state entry");
+
+  switch (transition)
+  {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      if (src->prewarm && !gst_ardu_cam_src_prewarm (src)) 
+      {
+        return GST_STATE_CHANGE_FAILURE;
+      }
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+      if (!STATS_GET (src->stats.frames))
+      {
+        STATS_SET (src->stats.playing_time, g_get_monotonic_time ());
+      }
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (gst_ardu_cam_src_parent_class)->change_state (
+    element, transition);
+
+  if (transition == GST_STATE_CHANGE_READY_TO_NULL || 
+    (transition == GST_STATE_CHANGE_NULL_TO_READY && 
+    ret == GST_STATE_CHANGE_FAILURE))
+  {
+    gst_ardu_cam_src_close (src);
+  }
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_change_state exit");
+
+  return ret;
+}
+
+static gboolean
+gst_ardu_cam_src_start (GstBaseSrc * parent)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (parent);
+
+  g_return_val_if_fail (src != NULL, FALSE);
+  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), FALSE);  
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_start entry");
+
+  // NOTE(marcin.sielski): Camera is opened only when the element is about to
+  // stream, unless pre-warmed in READY
+  if (!src->camera.instance && !gst_ardu_cam_src_open (src)) return FALSE;
+
+  g_atomic_int_set (&src->pool_hits, 0);
+  g_atomic_int_set (&src->pool_misses, 0);
+  gst_ardu_cam_src_stats_reset (src);
+
+  g_mutex_lock (&src->camera.lock);
+  gst_ardu_cam_src_shadow_invalidate (&src->camera);
+  g_mutex_unlock (&src->camera.lock);
+  STATS_SET (src->camera.shadow.writes_issued, 0);
+  STATS_SET (src->camera.shadow.writes_suppressed, 0);
+  g_mutex_lock (&src->secondary.lock);
+  gst_ardu_cam_src_shadow_invalidate (&src->secondary);
+  g_mutex_unlock (&src->secondary.lock);
+  STATS_SET (src->secondary.shadow.writes_issued, 0);
+  STATS_SET (src->secondary.shadow.writes_suppressed, 0);
+
+  g_atomic_int_set (&src->pair.resyncs, 0);
+  STATS_SET (src->latency, GST_CLOCK_TIME_NONE);
+  memset (&src->timestamps, 0, sizeof (ArduCamTimestamps));
+  gst_ardu_cam_src_qos_reset (src);
+  src->batch_flow = GST_FLOW_OK;
+  gst_base_src_set_do_timestamp (parent, 
+    src->timestamp_mode == GST_ARDU_CAM_SRC_TIMESTAMP_MODE_ARRIVAL);
+  if (src->secondary.instance) gst_ardu_cam_src_pair_thread_start (src);
+
+  g_atomic_int_set (&src->control.frame, 0);
+  if (src->async_controls) gst_ardu_cam_src_control_thread_start (src);
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_start exit");
+
+  return TRUE;
+}
+
+static gboolean
+gst_ardu_cam_src_stop (GstBaseSrc * parent)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (parent);
+
+  g_return_val_if_fail (src != NULL, FALSE);
+  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), FALSE);   
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_stop entry");
+
+  gst_ardu_cam_src_capture_thread_stop (src);
+  gst_ardu_cam_src_pair_thread_stop (src);
+  gst_ardu_cam_src_control_thread_stop (src);
+  arducam_demosaic_free (src->demosaicer);
+  src->demosaicer = NULL;
+  if (!src->prewarm) gst_ardu_cam_src_close (src);
+
+  GstStructure *stats = gst_ardu_cam_src_get_stats (src);
+  gchar *serialized = gst_structure_to_string (stats);
+  GST_INFO_OBJECT (src, "%s", serialized);
+  g_free (serialized);
+  gst_structure_free (stats);
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_stop exit");
+ 
+  return TRUE;
+}
+
+static gboolean
+gst_ardu_cam_src_unlock (GstBaseSrc * parent)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (parent);
+
+  g_return_val_if_fail (src != NULL, FALSE);
+  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), FALSE);
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_unlock entry");
+
+  g_mutex_lock (&src->ring.lock);
+  g_atomic_int_set (&src->ring.flushing, TRUE);
+  g_cond_broadcast (&src->ring.cond);
+  g_mutex_unlock (&src->ring.lock);
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_unlock exit");
+
+  return TRUE;
+}
+
+static gboolean
+gst_ardu_cam_src_unlock_stop (GstBaseSrc * parent)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (parent);
+  GstBuffer *gstbuf;
+
+  g_return_val_if_fail (src != NULL, FALSE);
+  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), FALSE);
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_unlock_stop entry");
+
+  // NOTE(marcin.sielski): Frames captured before the flush are stale
+  if (src->ring.slots)
+  {
+    while ((gstbuf = gst_ardu_cam_src_ring_take (&src->ring)))
+    {
+      gst_buffer_unref (gstbuf);
+    }
+  }
+  g_atomic_int_set (&src->ring.gaps, 0);
+  g_atomic_int_set (&src->ring.flushing, FALSE);
+  src->batch_flow = GST_FLOW_OK;
+  gst_ardu_cam_src_qos_reset (src);
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_unlock_stop exit");
+
+  return TRUE;
+}
+
+static gboolean
+gst_ardu_cam_src_query (GstBaseSrc * bsrc, GstQuery * query)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (bsrc);
+  GstClockTime min, max;
+
+  if (GST_QUERY_TYPE (query) == GST_QUERY_LATENCY &&
+    gst_ardu_cam_src_latency (src, &min, &max))
+  {
+    GST_DEBUG_OBJECT (src, "Reporting latency min %" GST_TIME_FORMAT 
+      " max %" GST_TIME_FORMAT, GST_TIME_ARGS (min), GST_TIME_ARGS (max));
+    gst_query_set_latency (query, TRUE, min, max);
+    return TRUE;
+  }
+
+  return GST_BASE_SRC_CLASS (parent_class)->query (bsrc, query);
+}
+
+// NOTE(marcin.sielski): Same deadline as GstVideoDecoder, a late frame moves
+// the earliest time by twice its lateness plus a frame period
+static gboolean
+gst_ardu_cam_src_event (GstBaseSrc * bsrc, GstEvent * event)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (bsrc);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_QOS && 
+    gst_base_src_is_qos_enabled (bsrc))
+  {
+    GstQOSType type;
+    gdouble proportion;
+    GstClockTimeDiff diff;
+    GstClockTime timestamp;
+    gdouble sensor_fps = gst_ardu_cam_src_get_sensor_fps (src);
+    GstClockTime period = sensor_fps > 0 ? 
+      (GstClockTime) (GST_SECOND / sensor_fps) : 0;
+
+    gst_event_parse_qos (event, &type, &proportion, &diff, &timestamp);
+    GST_OBJECT_LOCK (src);
+    src->qos.proportion = proportion;
+    if (diff > 0) src->qos.earliest_time = timestamp + 2 * diff + period;
+    else if ((GstClockTime) -diff < timestamp) 
+    {
+      src->qos.earliest_time = timestamp + diff;
+    }
+    else src->qos.earliest_time = 0;
+    GST_OBJECT_UNLOCK (src);
+    GST_LOG_OBJECT (src, "QoS proportion %.3f, diff %" G_GINT64_FORMAT 
+      ", timestamp %" GST_TIME_FORMAT, proportion, diff, 
+      GST_TIME_ARGS (timestamp));
+  }
+
+  return GST_BASE_SRC_CLASS (parent_class)->event (bsrc, event);
+}
+
+static gboolean
+gst_ardu_cam_src_decide_allocation (GstBaseSrc * bsrc, GstQuery * query)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (bsrc);
+  GstBufferPool *pool = NULL;
+  GstAllocator *allocator = NULL;
+  GstAllocationParams params;
+  GstStructure *config;
+  GstCaps *caps = NULL;
+  GstVideoInfo info;
+  guint size = 0, min = 0, max = 0;
+  gboolean update;
+
+  g_return_val_if_fail (src != NULL, FALSE);
+  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), FALSE);
+ 
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_decide_allocation entry");
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  gboolean video = gst_ardu_cam_src_output_is_video (src->output);
+  if (!caps || (video && !gst_video_info_from_caps (&info, caps)))
+  {
+    GST_ERROR_OBJECT (src, "Invalid caps in allocation query");
+    return FALSE;
+  }
+
+  if (gst_query_get_n_allocation_params (query) > 0)
+  {
+    gst_query_parse_nth_allocation_param (query, 0, &allocator, &params);
+  }
+  else gst_allocation_params_init (&params);
+  params.align = MAX (params.align, POOL_ALIGN);
+
+  // NOTE(marcin.sielski): Honor the pool proposed by downstream if any
+  update = gst_query_get_n_allocation_pools (query) > 0;
+  if (update)
+  {
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+  }
+  if (!pool) 
+  {
+    pool = video ? gst_video_buffer_pool_new () : gst_buffer_pool_new ();
+  }
+
+  // NOTE(marcin.sielski): Keep enough buffers in flight to cover roughly one
+  // 60 fps frame period, so high frame rate modes do not exhaust the pool
+  gint fps = 60, fps_n, fps_d;
+  if (gst_structure_get_fraction (gst_caps_get_structure (caps, 0), 
+    "framerate", &fps_n, &fps_d) && fps_n > 0 && fps_d > 0)
+  {
+    fps = fps_n / fps_d;
+  }
+  // NOTE(marcin.sielski): A maximum of 0 leaves the pool unlimited
+  size = MAX (size, src->frame_size);
+  min = MAX (min, POOL_MIN_BUFFERS + fps / 60);
+  if (max && max < min) max = min;
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  gst_buffer_pool_config_set_allocator (config, allocator, &params);
+  if (gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL) &&
+    gst_buffer_pool_has_option (pool, GST_BUFFER_POOL_OPTION_VIDEO_META))
+  {
+    gst_buffer_pool_config_add_option (config, 
+      GST_BUFFER_POOL_OPTION_VIDEO_META);
+  }
+  if (!gst_buffer_pool_set_config (pool, config))
+  {
+    // NOTE(marcin.sielski): Downstream pool may have adjusted the parameters
+    config = gst_buffer_pool_get_config (pool);
+    if (!gst_buffer_pool_config_validate_params (config, caps, size, min, 
+      max))
+    {
+      gst_structure_free (config);
+      config = NULL;
+    }
+    if (!config || !gst_buffer_pool_set_config (pool, config))
+    {
+      GST_ERROR_OBJECT (src, "Failed to configure buffer pool");
+      gst_object_unref (pool);
+      if (allocator) gst_object_unref (allocator);
+      return FALSE;
+    }
+  }
+
+  GST_DEBUG_OBJECT (src, "Using buffer pool with size %u, min %u, max %u", 
+    size, min, max);
+
+  if (update) gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+  else gst_query_add_allocation_pool (query, pool, size, min, max);
+
+  gst_object_unref (pool);
+  if (allocator) gst_object_unref (allocator);
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_decide_allocation exit");
+
+  return TRUE;
+}
+
+
+// NOTE(marcin.sielski): Frames of a stereo pair are placed side by side
+static gint
+gst_ardu_cam_src_views (GstArduCamSrc * src)
+{
+  GST_OBJECT_LOCK (src);
+  gint views = src->secondary_camera_num >= 0 ? 2 : 1;
+  GST_OBJECT_UNLOCK (src);
+
+  return views;
+}
+
+static void
+gst_ardu_cam_src_list_append_int (GValue * list, gint value)
+{
+  GValue item = G_VALUE_INIT;
+
+  g_value_init (&item, G_TYPE_INT);
+  g_value_set_int (&item, value);
+  gst_value_list_append_and_take_value (list, &item);
+}
+
+// NOTE(marcin.sielski): Caps of every output, in the order of preference
+// within a sensor mode
+static const struct
+{
+  ArduCamOutput output;
+  const gchar *name;
+  const gchar *format;
+}
+outputs[] = {
+  { ARDUCAM_OUTPUT_GRAY8, "video/x-raw", "GRAY8" },
+  { ARDUCAM_OUTPUT_GRAY16_LE, "video/x-raw", "GRAY16_LE" },
+  { ARDUCAM_OUTPUT_GRAY10_LE32, "video/x-raw", "GRAY10_LE32" },
+  { ARDUCAM_OUTPUT_RGB, "video/x-raw", "RGB" },
+  { ARDUCAM_OUTPUT_Y10P, "video/x-y10p", NULL },
+  { ARDUCAM_OUTPUT_BAYER, "video/x-bayer", "bggr" },
+  { ARDUCAM_OUTPUT_BAYER10, "video/x-bayer", "bggr10le" },
+};
+
+static gboolean
+gst_ardu_cam_src_output_from_structure (const GstStructure * structure,
+    ArduCamOutput * output)
+{
+  const gchar *format = gst_structure_get_string (structure, "format");
+
+  for (guint i = 0; i < G_N_ELEMENTS (outputs); i++)
+  {
+    if (gst_structure_has_name (structure, outputs[i].name) &&
+      (!outputs[i].format || !g_strcmp0 (format, outputs[i].format)))
+    {
+      *output = outputs[i].output;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+// NOTE(marcin.sielski): Output produced from the samples of the mode, -1 if
+// the mode can not produce it
+static gint
+gst_ardu_cam_src_mode_output (GstArduCamSrc * src, 
+    const ArduCamModeInfo * info, ArduCamOutput output)
+{
+  switch (info->pixelformat)
+  {
+    case V4L2_PIX_FMT_GREY:
+      if (output == ARDUCAM_OUTPUT_GRAY8) return output;
+      break;
+    case V4L2_PIX_FMT_Y10P:
+      if (output == ARDUCAM_OUTPUT_GRAY16_LE || 
+        output == ARDUCAM_OUTPUT_GRAY10_LE32 || output == ARDUCAM_OUTPUT_Y10P)
+      {
+        return output;
+      }
+      break;
+    case V4L2_PIX_FMT_SBGGR8:
+      // NOTE(marcin.sielski): Without demosaic bayer samples are passed as 
+      // GRAY8 as they always were
+      if (output == ARDUCAM_OUTPUT_GRAY8) 
+      {
+        return src->demosaic ? ARDUCAM_OUTPUT_LUMA : output;
+      }
+      if (output == ARDUCAM_OUTPUT_BAYER || 
+        (output == ARDUCAM_OUTPUT_RGB && src->demosaic))
+      {
+        return output;
+      }
+      break;
+    case V4L2_PIX_FMT_SBGGR10P:
+      if (output == ARDUCAM_OUTPUT_BAYER10) return output;
+      break;
+    default:
+      break;
+  }
+
+  return -1;
+}
+
+// NOTE(marcin.sielski): Size of the frames of a single camera delivered in
+// the mode
+static void
+gst_ardu_cam_src_mode_size (GstArduCamSrc * src, 
+    const ArduCamModeInfo * info, gint * width, gint * height)
+{
+  if (gst_ardu_cam_src_roi_enabled (src))
+  {
+    *width = src->roi_width;
+    *height = src->roi_height;
+  }
+  else
+  {
+    *width = info->width;
+    *height = info->height;
+  }
+}
+
+// NOTE(marcin.sielski): Whether the mode delivers the output, stereo pairs
+// are joined without conversion and region of interest is read out in 
+// 1280x800 modes only
+static gboolean
+gst_ardu_cam_src_mode_usable (GstArduCamSrc * src, 
+    const ArduCamModeInfo * info, ArduCamOutput output)
+{
+  gint mode_output = gst_ardu_cam_src_mode_output (src, info, output);
+
+  if (info->width <= 0 || mode_output < 0) return FALSE;
+  if (gst_ardu_cam_src_views (src) > 1 && 
+    !gst_ardu_cam_src_output_is_native (mode_output))
+  {
+    return FALSE;
+  }
+  if (gst_ardu_cam_src_roi_enabled (src) && 
+    (info->width != SENSOR_WIDTH || info->height != SENSOR_HEIGHT))
+  {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gint
+gst_ardu_cam_src_mode_bits (const ArduCamModeInfo * info)
+{
+  switch (info->pixelformat)
+  {
+    case V4L2_PIX_FMT_Y10P:
+    case V4L2_PIX_FMT_SBGGR10P:
+      return 10;
+    default:
+      return 8;
+  }
+}
+
+// NOTE(marcin.sielski): Data rate in bytes per second of a single camera 
+// reading out width x height samples of the mode at the frame rate
+static guint64
+gst_ardu_cam_src_data_rate (const ArduCamModeInfo * info, gint width, 
+    gint height, gdouble fps)
+{
+  return (guint64) ((gdouble) width * height * 
+    gst_ardu_cam_src_mode_bits (info) * fps / 8);
+}
+
+// NOTE(marcin.sielski): Copy of the modes of the sensor, which are replaced
+// when the camera is opened
+static void
+gst_ardu_cam_src_get_modes (GstArduCamSrc * src, ArduCamModeInfo * modes)
+{
+  GST_OBJECT_LOCK (src);
+  memcpy (modes, src->modes, sizeof (src->modes));
+  GST_OBJECT_UNLOCK (src);
+}
+
+// NOTE(marcin.sielski): Highest frame rate negotiated for the mode reading
+// out the given number of lines, whole frames per second at the default
+// vertical blanking
+static gdouble
+gst_ardu_cam_src_mode_max_fps (const ArduCamModeInfo * info, gint height)
+{
+  return (gint) gst_ardu_cam_src_mode_fps (info, height, VBLANK_LINES_DEFAULT);
+}
+
+// NOTE(marcin.sielski): Automatic selection picks the mode occupying the
+// least CSI-2 bandwidth at its maximum frame rate among the modes delivering
+// the resolution, format and frame rate, the lowest mode number on a tie. ETM
+// modes are only considered with external trigger enabled. Returns -1 when
+// no mode matches.
+static gint
+gst_ardu_cam_src_select_mode (GstArduCamSrc * src, ArduCamOutput output,
+    gint width, gint height, gint sensor_mode, gdouble fps)
+{
+  ArduCamModeInfo modes[ARDUCAM_SENSOR_MODES];
+  ArduCamSettings settings;
+  guint64 best_rate = G_MAXUINT64;
+  gint best = -1;
+
+  gst_ardu_cam_src_get_modes (src, modes);
+  gst_ardu_cam_src_config_read (&src->config, &settings);
+  for (gint mode = 0; mode < ARDUCAM_SENSOR_MODES; mode++)
+  {
+    const ArduCamModeInfo *info = &modes[mode];
+    gint mode_width, mode_height;
+
+    if (sensor_mode != GST_ARDU_CAM_SRC_SENSOR_MODE_AUTOMATIC && 
+      mode != sensor_mode) continue;
+    if (!gst_ardu_cam_src_mode_usable (src, info, output)) continue;
+    gst_ardu_cam_src_mode_size (src, info, &mode_width, &mode_height);
+    if ((width && width != gst_ardu_cam_src_views (src) * mode_width) || 
+      (height && height != mode_height)) continue;
+    // NOTE(marcin.sielski): The maximum is the one get_caps advertises, a
+    // faster frame rate is rejected rather than clamped
+    gdouble max_fps = gst_ardu_cam_src_mode_max_fps (info, mode_height);
+    if (fps > max_fps) continue;
+    if (sensor_mode != GST_ARDU_CAM_SRC_SENSOR_MODE_AUTOMATIC) return mode;
+
+    if (info->etm && !settings.external_trigger) continue;
+    guint64 rate = gst_ardu_cam_src_data_rate (info, mode_width, mode_height,
+      max_fps);
+    GST_LOG_OBJECT (src, "Sensor mode %d candidate, %" G_GUINT64_FORMAT 
+      " B/s", mode, rate);
+    if (rate < best_rate)
+    {
+      best_rate = rate;
+      best = mode;
+    }
+  }
+
+  return best;
+}
+
+static GstCaps *
+gst_ardu_cam_src_get_caps (GstBaseSrc * bsrc, GstCaps * filter)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (bsrc);
+  GstCaps *caps;
+  ArduCamModeInfo modes[ARDUCAM_SENSOR_MODES];
+  gint order[ARDUCAM_SENSOR_MODES];
+ 
+  g_return_val_if_fail (bsrc != NULL, FALSE); 
+ 
+  GST_LOG_OBJECT (bsrc, "gst_ardu_cam_src_get_caps entry");
+
+  gst_ardu_cam_src_get_modes (src, modes);
+
+  // NOTE(marcin.sielski): Modes are listed from the smallest resolution, so 
+  // that unconstrained negotiation fixates to the smallest frame, and by 
+  // number within a resolution, so that the lowest matching mode is preferred
+  for (gint i = 0; i < ARDUCAM_SENSOR_MODES; i++)
+  {
+    gint area = modes[i].width * modes[i].height;
+    gint j = i;
+    for (; j > 0 && modes[order[j - 1]].width * 
+      modes[order[j - 1]].height > area; j--)
+    {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+  }
+
+  caps = gst_caps_new_empty ();
+  gint views = gst_ardu_cam_src_views (src);
+  for (gint i = 0; i < ARDUCAM_SENSOR_MODES; i++)
+  {
+    const ArduCamModeInfo *info = &modes[order[i]];
+    gint width, height;
+    gst_ardu_cam_src_mode_size (src, info, &width, &height);
+    // NOTE(marcin.sielski): Region of interest is read out at a frame rate 
+    // raised by the lines skipped
+    gint fps = (gint) gst_ardu_cam_src_mode_max_fps (info, height);
+    for (guint j = 0; j < G_N_ELEMENTS (outputs); j++)
+    {
+      if (!gst_ardu_cam_src_mode_usable (src, info, outputs[j].output)) 
+      {
+        continue;
+      }
+      GstStructure *structure = gst_structure_new_empty (outputs[j].name);
+      if (outputs[j].format)
+      {
+        gst_structure_set (structure, 
+          "format", G_TYPE_STRING, outputs[j].format, NULL);
+      }
+      gst_structure_set (structure, 
+        "width", G_TYPE_INT, views * width,
+        "height", G_TYPE_INT, height,
+        "framerate", GST_TYPE_FRACTION_RANGE, 0, 1, fps, 1,
+        NULL);
+      // NOTE(marcin.sielski): Fixation prefers automatic selection, 
+      // downstream may still pin the mode
+      GValue sensor_mode = G_VALUE_INIT;
+      g_value_init (&sensor_mode, GST_TYPE_LIST);
+      gst_ardu_cam_src_list_append_int (&sensor_mode, 
+        GST_ARDU_CAM_SRC_SENSOR_MODE_AUTOMATIC);
+      gst_ardu_cam_src_list_append_int (&sensor_mode, order[i]);
+      gst_structure_take_value (structure, "sensor-mode", &sensor_mode);
+      gst_structure_set (structure, 
+        "timeout", GST_TYPE_INT_RANGE, -1, G_MAXINT, NULL);
+      gst_caps_append_structure (caps, structure);
+    }
+  }
+
+  if (filter)
+  {
+    GstCaps *intersection = 
+      gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (caps);
+    caps = intersection;
+  }
+ 
+  GST_LOG_OBJECT (bsrc, "gst_ardu_cam_src_get_caps exit");
+ 
+  return caps;
+}
+
+
+static gboolean
+gst_ardu_cam_src_set_mode (GstArduCamSrc * src, ArduCamCamera * camera)
+{
+  g_mutex_lock (&camera->lock);
+  // NOTE(marcin.sielski): Mode switch reloads the sensor register tables
+  gst_ardu_cam_src_shadow_invalidate (camera);
+  if (arducam_set_mode (camera->instance, src->sensor_mode))
+  {
+    g_mutex_unlock (&camera->lock);
+    GST_ERROR_OBJECT (src, "Could not set sensor mode");
+    return FALSE;
+  }
+  // NOTE(marcin.sielski): For some reason first capture timeouts, later
+  // mode switches take effect with a single call.
+  if (!camera->warm)
+  {
+    BUFFER *buffer = arducam_capture(camera->instance, &camera->format, 100);
+    if (buffer) arducam_release_buffer(buffer);
+    if (arducam_set_mode (camera->instance, src->sensor_mode))
+    {
+      g_mutex_unlock (&camera->lock);
+      GST_ERROR_OBJECT (src, "Could not set sensor mode");
+      return FALSE;
+    }
+    camera->warm = TRUE;
+    GST_DEBUG_OBJECT (src, "Camera %d warmed up", camera->num);
+  }
+  g_mutex_unlock (&camera->lock);
+
+  return TRUE;
+}
+
+// NOTE(marcin.sielski): Vertical blanking is read back from the frame length
+// (VTS) loaded by the first switch to the mode and cached until the camera is
+// reopened
+static void
+gst_ardu_cam_src_read_vblank (GstArduCamSrc * src, ArduCamCamera * camera)
+{
+  const ArduCamModeInfo *info = &src->modes[src->sensor_mode];
+  guint16 high, low;
+
+  if (src->mode_vblank[src->sensor_mode])
+  {
+    src->vblank = src->mode_vblank[src->sensor_mode];
+    return;
+  }
+  src->vblank = VBLANK_LINES_DEFAULT;
+  g_mutex_lock (&camera->lock);
+  if (!arducam_read_sensor_reg (camera->instance, 0x380E, &high) &&
+    !arducam_read_sensor_reg (camera->instance, 0x380F, &low) &&
+    ((high << 8) | low) > info->height)
+  {
+    src->vblank = ((high << 8) | low) - info->height;
+  }
+  g_mutex_unlock (&camera->lock);
+  src->mode_vblank[src->sensor_mode] = src->vblank;
+}
+
+// NOTE(marcin.sielski): Programs the OV9281 window, output size and frame
+// length so that only the region of interest is read out
+static gboolean
+gst_ardu_cam_src_set_window (GstArduCamSrc * src, ArduCamCamera * camera)
+{
+  gint result = 0;
+
+  g_mutex_lock (&camera->lock);
+  // NOTE(marcin.sielski): Vertical blanking of the mode is kept, so is the
+  // line time and hence exposure
+  const guint16 registers[][2] = {
+    { 0x3800, src->roi_x },
+    { 0x3802, src->roi_y },
+    { 0x3804, src->roi_x + src->roi_width + 2 * ISP_MARGIN - 1 },
+    { 0x3806, src->roi_y + src->roi_height + 2 * ISP_MARGIN - 1 },
+    { 0x3808, src->roi_width },
+    { 0x380A, src->roi_height },
+    { 0x380E, src->roi_height + src->vblank },
+  };
+  // NOTE(marcin.sielski): Written through the shadow, so that the frame
+  // length cached by frame rate changes stays coherent
+  for (guint i = 0; i < G_N_ELEMENTS (registers); i++)
+  {
+    result |= gst_ardu_cam_src_write_reg (camera, registers[i][0], 
+      registers[i][1] >> 8);
+    result |= gst_ardu_cam_src_write_reg (camera, registers[i][0] + 1, 
+      registers[i][1] & 0xff);
+  }
+  g_mutex_unlock (&camera->lock);
+
+  if (result)
+  {
+    GST_ERROR_OBJECT (src, "Could not set region of interest");
+    return FALSE;
+  }
+  GST_DEBUG_OBJECT (src, "Region of interest %dx%d at %d,%d on camera %d", 
+    src->roi_width, src->roi_height, src->roi_x, src->roi_y, camera->num);
+
+  return TRUE;
+}
+
+static gboolean
+gst_ardu_cam_src_switch_mode (GstArduCamSrc * src, gint sensor_mode)
+{
+  const ArduCamModeInfo *mode_info = &src->modes[sensor_mode];
+  gint64 begin = g_get_monotonic_time ();
+  gint width, height;
+
+  gst_ardu_cam_src_mode_size (src, mode_info, &width, &height);
+  src->mode_configured = FALSE;
+  src->sensor_mode = sensor_mode;
+  if (!gst_ardu_cam_src_set_mode (src, &src->camera)) return FALSE;
+  if (src->secondary.instance && 
+    !gst_ardu_cam_src_set_mode (src, &src->secondary))
+  {
+    return FALSE;
+  }
+  gst_ardu_cam_src_read_vblank (src, &src->camera);
+  if (gst_ardu_cam_src_roi_enabled (src) && 
+    (!gst_ardu_cam_src_set_window (src, &src->camera) ||
+    (src->secondary.instance && 
+    !gst_ardu_cam_src_set_window (src, &src->secondary))))
+  {
+    return FALSE;
+  }
+  gst_ardu_cam_src_set_sensor_fps (src, gst_ardu_cam_src_mode_fps (mode_info,
+    height, src->vblank));
+  src->mode_configured = TRUE;
+
+  guint64 elapsed = g_get_monotonic_time () - begin;
+  STATS_ADD (src->stats.mode_switches, 1);
+  STATS_SET (src->stats.mode_switch_time, elapsed);
+  STATS_MAX (src->stats.mode_switch_time_max, elapsed);
+  GST_INFO_OBJECT (src, "Sensor mode %d reads out %dx%d at %.1f fps, "
+    "switched in %" G_GUINT64_FORMAT " us", src->sensor_mode, width, height, 
+    gst_ardu_cam_src_get_sensor_fps (src), elapsed);
+
+  return TRUE;
+}
+
+// NOTE(marcin.sielski): Opens the camera and configures the last negotiated
+// sensor mode, or the one unconstrained negotiation selects, so that start
+// and set_caps find the sensor ready
+static gboolean
+gst_ardu_cam_src_prewarm (GstArduCamSrc * src)
+{
+  gint64 begin = g_get_monotonic_time ();
+
+  if (!src->camera.instance && !gst_ardu_cam_src_open (src)) return FALSE;
+  if (src->mode_configured) return TRUE;
+
+  gint sensor_mode = src->sensor_mode;
+  if (sensor_mode == GST_ARDU_CAM_SRC_SENSOR_MODE_AUTOMATIC)
+  {
+    sensor_mode = gst_ardu_cam_src_select_mode (src, ARDUCAM_OUTPUT_GRAY8, 
+      0, 0, GST_ARDU_CAM_SRC_SENSOR_MODE_AUTOMATIC, 0);
+  }
+  if (sensor_mode < 0 || !gst_ardu_cam_src_switch_mode (src, sensor_mode))
+  {
+    gst_ardu_cam_src_close (src);
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT (src, "Pre-warmed in %" G_GINT64_FORMAT " us", 
+    g_get_monotonic_time () - begin);
+
+  return TRUE;
+}
+
+static gboolean
+gst_ardu_cam_src_set_caps (GstBaseSrc * bsrc, GstCaps * caps)
+{
+  GstArduCamSrc *src = GST_ARDUCAMSRC (bsrc);
+  GstVideoInfo info;
+  GstStructure *structure;
+  ArduCamOutput output;
+
+  g_return_val_if_fail (src != NULL, FALSE);
+  g_return_val_if_fail (GST_IS_ARDUCAMSRC (src), FALSE); 
+
+  GST_LOG_OBJECT (src, "gst_ardu_cam_src_set_caps entry");
+
+  gint views = gst_ardu_cam_src_views (src);
+  gboolean roi = gst_ardu_cam_src_roi_enabled (src);
+  if (roi && (src->roi_x + src->roi_width > SENSOR_WIDTH || 
+    src->roi_y + src->roi_height > SENSOR_HEIGHT || 
+    src->roi_width % ROI_WIDTH_ALIGN || src->roi_height % 2 || 
+    src->roi_x % 2 || src->roi_y % 2))
+  {
+    GST_ERROR_OBJECT (src, "Region of interest not supported");
+    return FALSE;
+  }
+
+  structure = gst_caps_get_structure (caps, 0);
+  gst_video_info_init (&info);
+  if (!gst_ardu_cam_src_output_from_structure (structure, &output))
+  {
+    GST_ERROR_OBJECT (src, "Format not supported");
+    return FALSE;
+  }
+  if (gst_ardu_cam_src_output_is_video (output) && 
+    !gst_video_info_from_caps (&info, caps))
+  {
+    return FALSE;
+  }
+  gint width = 0, height = 0;
+  gint sensor_mode = GST_ARDU_CAM_SRC_SENSOR_MODE_AUTOMATIC;
+  gint fps_n = 0, fps_d = 1;
+  gst_structure_get_int (structure, "width", &width);
+  gst_structure_get_int (structure, "height", &height);
+  gst_structure_get_int (structure, "sensor-mode", &sensor_mode);
+  if (!gst_structure_get_fraction (structure, "framerate", &fps_n, &fps_d) ||
+    fps_n <= 0 || fps_d <= 0)
+  {
+    fps_n = 0;
+    fps_d = 1;
+  }
+  sensor_mode = gst_ardu_cam_src_select_mode (src, output, width, height, 
+    sensor_mode, (gdouble) fps_n / fps_d);
+  if (sensor_mode < 0)
+  {
+    GST_ERROR_OBJECT (src, "No sensor mode supports the caps");
+    return FALSE;
+  }
+  const ArduCamModeInfo *mode_info = &src->modes[sensor_mode];
+  gboolean mode_changed = sensor_mode != (gint) src->sensor_mode;
+  gint mode_width, mode_height;
+  gst_ardu_cam_src_mode_size (src, mode_info, &mode_width, &mode_height);
+  output = gst_ardu_cam_src_mode_output (src, mode_info, output);
+  // NOTE(marcin.sielski): Renegotiation while PLAYING waits for the frame
+  // being captured, frames of the previous format still queued are dropped.
+  // The capture thread is restarted by the next create.
+  if (src->ring.thread && (mode_changed || output != src->output ||
+    mode_width != src->width || mode_height != src->height))
+  {
+    gst_ardu_cam_src_capture_thread_stop (src);
+  }
+  // NOTE(marcin.sielski): Taken once the capture thread is stopped, which
+  // may be recovering with the lock held
+  g_mutex_lock (&src->mode_lock);
+  src->width = mode_width;
+  src->height = mode_height;
+  src->output = output;
+  switch (output)
+  {
+    case ARDUCAM_OUTPUT_Y10P:
+      // NOTE(marcin.sielski): Packed lines are passed as delivered by the SDK
+      src->stride = SDK_STRIDE (ARDUCAM_RAW10_LINE_SIZE (views * src->width));
+      break;
+    case ARDUCAM_OUTPUT_BAYER:
+      src->stride = GST_ROUND_UP_4 (views * src->width);
+      break;
+    case ARDUCAM_OUTPUT_BAYER10:
+      src->stride = GST_ROUND_UP_4 (src->width * 2);
+      break;
+    default:
+      src->info = info;
+      src->stride = GST_VIDEO_INFO_PLANE_STRIDE (&info, 0);
+      break;
+  }
+  src->frame_size = src->stride * src->height;
+  if ((output == ARDUCAM_OUTPUT_RGB || output == ARDUCAM_OUTPUT_LUMA) && 
+    !src->demosaicer)
+  {
+    src->demosaicer = arducam_demosaic_new (src->demosaic_threads);
+  }
+  GST_DEBUG_OBJECT (src, "Output %d, frame size %" G_GSIZE_FORMAT 
+    ", unpack %s", output, src->frame_size, arducam_unpack_implementation ());
+  // NOTE(marcin.sielski): Renegotiation changing only the frame rate keeps
+  // the sensor streaming, the frame length is updated between frames
+  guint change_flags = PROP_CHANGE_FRAMERATE;
+  if (!src->mode_configured || mode_changed)
+  {
+    if (!gst_ardu_cam_src_switch_mode (src, sensor_mode)) 
+    {
+      g_mutex_unlock (&src->mode_lock);
+      return FALSE;
+    }
+    // NOTE(marcin.sielski): Mode switch reloads the sensor registers, the
+    // controls are applied again
+    change_flags = PROP_CHANGE_ALL;
+  }
+  gst_ardu_cam_src_config_write_begin (&src->config);
+  src->config.settings.fps_n = fps_n;
+  src->config.settings.fps_d = fps_d;
+  gst_ardu_cam_src_config_write_end (&src->config, change_flags);
+  gst_ardu_cam_src_control_wake (src);
+  ArduCamSettings settings;
+  gst_ardu_cam_src_config_read (&src->config, &settings);
+  if (src->secondary.instance && !settings.external_trigger && 
+    !mode_info->etm)
+  {
+    GST_WARNING_OBJECT (src, "Stereo pair is not externally triggered, "
+      "frames may not be paired");
+  }
+  gdouble max_fps = gst_ardu_cam_src_mode_fps (mode_info, src->height, 
+    src->vblank);
+  gdouble fps = max_fps;
+  if (fps_n > 0) fps = MIN (fps, (gdouble) fps_n / fps_d);
+  guint64 data_rate = views * 
+    gst_ardu_cam_src_data_rate (mode_info, src->width, src->height, fps);
+  GST_INFO_OBJECT (src, "Sensor mode %d at %.1f fps, %" G_GUINT64_FORMAT 
+    " B/s", src->sensor_mode, fps, data_rate);
+  g_mutex_unlock (&src->mode_lock);
+  if (mode_changed) g_object_notify (G_OBJECT (src), "sensor-mode");
+  gst_element_post_message (GST_ELEMENT (src), 
+    gst_message_new_element (GST_OBJECT (src), 
+      gst_structure_new ("arducamsrc-mode",
+        "sensor-mode", G_TYPE_INT, (gint) src->sensor_mode,
+        "width", G_TYPE_INT, views * src->width,
+        "height", G_TYPE_INT, src->height,
+        "lanes", G_TYPE_INT, mode_info->lanes,
+        "max-framerate", G_TYPE_DOUBLE, max_fps,
+        "framerate", GST_TYPE_FRACTION, fps_n, fps_d,
+        "data-rate", G_TYPE_UINT64, data_rate,
+        NULL)));
   gint timeout = -1;
   if (gst_structure_get_int (
-    structure, "sensor-mode", &timeout) && timeout != -1) {
-    src->config.timeout = timeout;
+    structure, "timeout", &timeout) && timeout != -1) {
+    gst_ardu_cam_src_config_write_begin (&src->config);
+    src->config.settings.timeout = timeout;
+    gst_ardu_cam_src_config_write_end (&src->config, 0);
   }
+  gst_ardu_cam_src_update_latency (src);
   GST_LOG_OBJECT (bsrc, "gst_ardu_cam_src_set_caps exit");
 
   return TRUE;
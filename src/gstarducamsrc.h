@@ -27,7 +27,9 @@
 
 #include <gst/gst.h>
 #include <gst/base/gstpushsrc.h>
+#include <gst/video/video.h>
 #include "arducam_mipicamera.h"
+#include "arducamdemosaic.h"
 
 G_BEGIN_DECLS
 
@@ -53,7 +55,9 @@ typedef enum
   PROP_CHANGE_GAIN             = (1 << 3),
   PROP_CHANGE_EXTERNAL_TRIGGER = (1 << 4),
   PROP_CHANGE_EXPOSURE_MODE    = (1 << 5),
-  PROP_CHANGE_AWB              = (1 << 6)
+  PROP_CHANGE_AWB              = (1 << 6),
+  PROP_CHANGE_FRAMERATE        = (1 << 7),
+  PROP_CHANGE_ALL              = (1 << 8) - 1
 } ArduCamPropChangeFlags;
 
 typedef enum {
@@ -131,10 +135,61 @@ GstArduCamSrcAWB;
 
 GType gst_ardu_cam_src_awb_get_type (void);
 
+typedef enum {
+  GST_ARDU_CAM_SRC_OVERFLOW_POLICY_DROP_OLDEST = 0,
+  GST_ARDU_CAM_SRC_OVERFLOW_POLICY_DROP_NEWEST = 1,
+  GST_ARDU_CAM_SRC_OVERFLOW_POLICY_BLOCK = 2,
+}
+GstArduCamSrcOverflowPolicy;
+
+GType gst_ardu_cam_src_overflow_policy_get_type (void);
+
+typedef enum {
+  GST_ARDU_CAM_SRC_TIMESTAMP_MODE_ARRIVAL = 0,
+  GST_ARDU_CAM_SRC_TIMESTAMP_MODE_SENSOR = 1,
+}
+GstArduCamSrcTimestampMode;
+
+GType gst_ardu_cam_src_timestamp_mode_get_type (void);
+
+typedef enum {
+  GST_ARDU_CAM_SRC_RECOVERY_ERROR = 0,
+  GST_ARDU_CAM_SRC_RECOVERY_RETRY = 1,
+}
+GstArduCamSrcRecovery;
+
+GType gst_ardu_cam_src_recovery_get_type (void);
+
+typedef enum {
+  ARDUCAM_OUTPUT_GRAY8,
+  ARDUCAM_OUTPUT_GRAY16_LE,
+  ARDUCAM_OUTPUT_GRAY10_LE32,
+  ARDUCAM_OUTPUT_Y10P,
+  ARDUCAM_OUTPUT_BAYER,
+  ARDUCAM_OUTPUT_BAYER10,
+  ARDUCAM_OUTPUT_RGB,
+  ARDUCAM_OUTPUT_LUMA,
+}
+ArduCamOutput;
+
+#define ARDUCAM_SENSOR_MODES 23
+
+// NOTE(marcin.sielski): Sensor mode indexed by GstArduCamSrcSensorMode, the
+// resolution and format come from the SDK when the camera is open. A width
+// of 0 marks a mode the SDK does not support.
+typedef struct
+{
+  gint width;
+  gint height;
+  guint32 pixelformat;
+  gint fps;
+  gint lanes;
+  gboolean etm;
+}
+ArduCamModeInfo;
+
 typedef struct
 {
-  GMutex lock;
-  ArduCamPropChangeFlags change_flags;
   gboolean hflip;
   gboolean vflip;
   gint shutter_speed;
@@ -143,19 +198,273 @@ typedef struct
   gboolean exposure_mode;
   gint timeout;
   GstArduCamSrcAWB awb;
+  gint fps_n;
+  gint fps_d;
+  // NOTE(marcin.sielski): Share of the frame rate the sensor runs at, 
+  // lowered by QoS throttling
+  gdouble throttle;
+}
+ArduCamSettings;
+
+// NOTE(marcin.sielski): Settings are published with a sequence lock. The
+// mutex only serializes writers, readers never block and retry their copy
+// if a writer was active. Pending ArduCamPropChangeFlags are accumulated
+// atomically and consumed by the capture path.
+typedef struct
+{
+  GMutex lock;
+  volatile gint sequence;
+  volatile guint change_flags;
+  ArduCamSettings settings;
 }
 ArduCamConfig;
 
+// NOTE(marcin.sielski): Single producer (capture thread), single consumer
+// (streaming thread) ring of captured frames. The head and tail indices are
+// free running and the size is a power of two. The lock and condition are
+// only used to sleep when the ring is empty or full.
+typedef struct
+{
+  GstBuffer **slots;
+  guint size;
+  volatile gint head;
+  volatile gint tail;
+  volatile gint drops;
+  volatile gint waiting;
+  volatile gint flushing;
+  volatile gint stopping;
+  volatile gint flow;
+  volatile gint gaps;
+  GMutex lock;
+  GCond cond;
+  GThread *thread;
+}
+ArduCamRing;
+
+// NOTE(marcin.sielski): Background worker applying queued control changes
+// right after a frame completes. Each applied batch of changes is a new
+// settings generation, effective from frame first_frame onwards. The
+// generation is published under the lock with a sequence lock, so that the
+// streaming thread reads it for every frame without blocking.
+typedef struct
+{
+  GThread *thread;
+  GMutex lock;
+  GCond cond;
+  gboolean running;
+  volatile gint frame;
+  volatile gint sequence;
+  guint generation;
+  guint64 first_frame;
+  ArduCamSettings applied;
+}
+ArduCamControl;
+
+typedef enum {
+  ARDUCAM_SHADOW_EXTERNAL_TRIGGER,
+  ARDUCAM_SHADOW_HFLIP,
+  ARDUCAM_SHADOW_VFLIP,
+  ARDUCAM_SHADOW_AUTO_EXPOSURE,
+  ARDUCAM_SHADOW_EXPOSURE,
+  ARDUCAM_SHADOW_GAIN,
+  ARDUCAM_SHADOW_CONTROLS
+}
+ArduCamShadowControl;
+
+// NOTE(marcin.sielski): Enough for the white balance, frame length and
+// region of interest registers, at most 32 as the valid mask is a guint
+#define ARDUCAM_SHADOW_REGISTERS 24
+
+// NOTE(marcin.sielski): Last values written to the sensor controls and
+// registers. Writes of an unchanged value are suppressed, the valid masks
+// are cleared whenever the sensor state is not known (mode switch, start).
+// Guarded by the camera lock.
+typedef struct
+{
+  gint controls[ARDUCAM_SHADOW_CONTROLS];
+  guint controls_valid;
+  guint16 addresses[ARDUCAM_SHADOW_REGISTERS];
+  guint16 values[ARDUCAM_SHADOW_REGISTERS];
+  guint registers;
+  guint registers_valid;
+  guint64 writes_issued;
+  guint64 writes_suppressed;
+}
+ArduCamShadow;
+
+// NOTE(marcin.sielski): Log-linear histogram, 16 buckets per power of two
+// microseconds which keeps percentiles within ~6% of the measured value.
+#define ARDUCAM_STATS_BUCKETS 512
+
+// NOTE(marcin.sielski): Times are g_get_monotonic_time() microseconds, the
+// ones updated with the counter macros are unsigned like the counters
+typedef struct
+{
+  gint64 start_time;
+  guint64 playing_time;
+  guint64 first_buffer_time;
+  guint64 last_buffer_time;
+  guint64 frames;
+  // NOTE(marcin.sielski): Buffers and buffer lists returned by create(), the
+  // create and push times are measured per create() call
+  guint64 creates;
+  guint64 bytes_copied;
+  guint64 allocations;
+  guint64 create_time_max;
+  guint create_time[ARDUCAM_STATS_BUCKETS];
+  guint64 processing_time;
+  guint64 timestamped;
+  guint64 timestamp_jitter_max;
+  guint timestamp_jitter[ARDUCAM_STATS_BUCKETS];
+  guint64 mode_switches;
+  guint64 mode_switch_time;
+  guint64 mode_switch_time_max;
+  guint64 sensor_frames;
+  guint64 timeouts;
+  guint64 captures;
+  guint64 capture_time_max;
+  guint capture_time[ARDUCAM_STATS_BUCKETS];
+  guint64 copy_time;
+  guint64 copy_time_max;
+  guint64 control_applies;
+  guint64 control_apply_time;
+  guint64 control_apply_time_max;
+  guint64 push_time;
+  guint64 push_time_max;
+  gint64 interval_time;
+  guint64 interval_frames;
+  guint64 gaps;
+  guint64 recoveries;
+  guint64 recovery_time_max;
+  guint64 qos_skipped;
+  guint64 qos_throttles;
+  guint64 batches;
+}
+ArduCamStats;
+
+// NOTE(marcin.sielski): Mapping of the SDK frame timestamps (microseconds of
+// the VideoCore clock) to the monotonic clock, updated by the thread 
+// capturing frames.
+typedef struct
+{
+  guint64 frames;
+  guint64 sequence;
+  guint64 last_pts;
+  gint64 offset;
+  gint64 window_min;
+  guint window_frames;
+}
+ArduCamTimestamps;
+
+// NOTE(marcin.sielski): Last QoS event received from downstream, guarded by
+// the object lock. The window counters and the share of the frame rate the
+// sensor is throttled to are only used by the thread capturing frames.
+typedef struct
+{
+  GstClockTime earliest_time;
+  gdouble proportion;
+  guint frames;
+  guint skipped;
+  gdouble ratio;
+}
+ArduCamQos;
+
+// NOTE(marcin.sielski): Camera owned by the element. The lock serializes
+// sensor configuration (mode, controls and registers) of this camera only,
+// capture itself runs unlocked so controls can be applied while waiting for
+// a frame. The first capture after open times out unless the sensor mode is
+// set twice around a throwaway capture, which warm records as done.
+typedef struct
+{
+  gint num;
+  CAMERA_INSTANCE instance;
+  IMAGE_FORMAT format;
+  GMutex lock;
+  ArduCamShadow shadow;
+  gboolean warm;
+}
+ArduCamCamera;
+
+// NOTE(marcin.sielski): Worker capturing from the secondary camera while the
+// streaming (or capture) thread captures from the primary one, so that both
+// sensors are read out in lockstep. Each request is answered with one frame.
+typedef struct
+{
+  GThread *thread;
+  GMutex lock;
+  GCond cond;
+  gboolean running;
+  guint requested;
+  guint completed;
+  gint timeout;
+  BUFFER *buffer;
+  volatile gint resyncs;
+}
+ArduCamPair;
+
 struct _GstArduCamSrc
 {
   GstPushSrc parent;
 
   gchar name[7];     // 'ov' (2) + four digits (4) + NULL (1) = name (7)
   gchar revision[5]; // rev (2) + NULL (1) + padding (2) = revision (5)
+  gint camera_num;
+  gboolean prewarm;
+  ArduCamCamera camera;
+  gint secondary_camera_num;
+  ArduCamCamera secondary;
+  gint pair_tolerance;
+  ArduCamPair pair;
   gint width;
   gint height;
+  // NOTE(marcin.sielski): Serializes the sensor mode configuration of
+  // set_caps against the recovery on the capture thread
+  GMutex mode_lock;
   GstArduCamSrcSensorMode sensor_mode;
+  ArduCamModeInfo modes[ARDUCAM_SENSOR_MODES];
+  gint roi_x;
+  gint roi_y;
+  gint roi_width;
+  gint roi_height;
+  gint vblank;
+  gint mode_vblank[ARDUCAM_SENSOR_MODES];
+  // NOTE(marcin.sielski): In millihertz, accessed atomically as the control
+  // thread updates it while streaming
+  gint sensor_fps;
+  GstClockTime latency;
+  GstArduCamSrcTimestampMode timestamp_mode;
+  ArduCamTimestamps timestamps;
+  ArduCamQos qos;
+  gboolean qos_throttle;
+  gint batch_size;
+  gint batch_time;
+  // NOTE(marcin.sielski): Flow that ended the last batch early, returned by
+  // the next create() once the partial batch was submitted
+  GstFlowReturn batch_flow;
+  gboolean mode_configured;
+  ArduCamOutput output;
+  GstVideoInfo info;
+  gsize frame_size;
+  gint stride;
+  gboolean demosaic;
+  gint demosaic_threads;
+  ArduCamDemosaic *demosaicer;
   ArduCamConfig config;
+  gboolean zero_copy;
+  gint max_outstanding_buffers;
+  volatile gint outstanding_buffers;
+  volatile gint pool_hits;
+  volatile gint pool_misses;
+  gboolean capture_thread;
+  gint ring_size;
+  GstArduCamSrcOverflowPolicy overflow_policy;
+  ArduCamRing ring;
+  ArduCamStats stats;
+  guint stats_interval;
+  GstArduCamSrcRecovery recovery;
+  gint max_retries;
+  gboolean async_controls;
+  ArduCamControl control;
 };
 
 struct _GstArduCamSrcClass 
@@ -0,0 +1,724 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/videodev2.h>
+#include "arducam_mipicamera.h"
+
+#define SIM_MAX_CAMERAS 2
+#define SIM_BUFFERS_DEFAULT 4
+#define SIM_EXPOSURE_DEFAULT 681
+#define SIM_ALIGN(x, a) (((x) + (a) - 1) & ~((a) - 1))
+#define SIM_VBLANK_LINES 110
+#define SIM_ISP_MARGIN 8
+#define SIM_REG16(sim, address) \
+  (((sim)->regs[(address)] << 8) | (sim)->regs[(address) + 1])
+
+typedef struct
+{
+  int width;
+  int height;
+  uint32_t pixelformat;
+  int fps;
+  int etm;
+  const char *description;
+}
+SimMode;
+
+// NOTE(marcin.sielski): Indexed by GstArduCamSrcSensorMode
+static const SimMode sim_modes[] = {
+  {1280, 800, V4L2_PIX_FMT_GREY, 60, 0, "1280x800 GREY 60fps 1lane"},
+  {1280, 720, V4L2_PIX_FMT_GREY, 60, 0, "1280x720 GREY 60fps 1lane"},
+  {640, 400, V4L2_PIX_FMT_GREY, 210, 0, "640x400 GREY 210fps 1lane"},
+  {320, 200, V4L2_PIX_FMT_GREY, 420, 0, "320x200 GREY 420fps 1lane"},
+  {160, 100, V4L2_PIX_FMT_GREY, 480, 0, "160x100 GREY 480fps 1lane"},
+  {1280, 800, V4L2_PIX_FMT_GREY, 480, 0, "1280x800 GREY 480fps 2lanes"},
+  {1280, 800, V4L2_PIX_FMT_Y10P, 480, 0, "1280x800 Y10P 480fps 2lanes"},
+  {1280, 800, V4L2_PIX_FMT_GREY, 60, 1, "1280x800 GREY 60fps 1lane ETM"},
+  {1280, 720, V4L2_PIX_FMT_GREY, 60, 1, "1280x720 GREY 60fps 1lane ETM"},
+  {640, 400, V4L2_PIX_FMT_GREY, 60, 1, "640x400 GREY 60fps 1lane ETM"},
+  {320, 200, V4L2_PIX_FMT_GREY, 60, 1, "320x200 GREY 60fps 1lane ETM"},
+  {1280, 800, V4L2_PIX_FMT_GREY, 60, 1, "1280x800 GREY 60fps 2lanes ETM"},
+  {1280, 800, V4L2_PIX_FMT_Y10P, 60, 1, "1280x800 Y10P 60fps 2lanes ETM"},
+  {1280, 720, V4L2_PIX_FMT_GREY, 60, 1, "1280x720 GREY 60fps 2lanes ETM"},
+  {640, 400, V4L2_PIX_FMT_GREY, 60, 1, "640x400 GREY 60fps 2lanes ETM"},
+  {320, 200, V4L2_PIX_FMT_GREY, 60, 1, "320x200 GREY 60fps 2lanes ETM"},
+  {1280, 800, V4L2_PIX_FMT_SBGGR8, 60, 0, "1280x800 BA81 60fps 1lane"},
+  {1280, 720, V4L2_PIX_FMT_SBGGR8, 60, 0, "1280x720 BA81 60fps 1lane"},
+  {640, 400, V4L2_PIX_FMT_SBGGR8, 210, 0, "640x400 BA81 210fps 1lane"},
+  {320, 200, V4L2_PIX_FMT_SBGGR8, 420, 0, "320x200 BA81 420fps 1lane"},
+  {160, 100, V4L2_PIX_FMT_SBGGR8, 480, 0, "160x100 BA81 480fps 1lane"},
+  {1280, 800, V4L2_PIX_FMT_SBGGR8, 480, 0, "1280x800 BA81 480fps 2lanes"},
+  {1280, 800, V4L2_PIX_FMT_SBGGR10P, 480, 0, "1280x800 pBAA 480fps 1lane"},
+};
+
+#define SIM_N_MODES ((int) (sizeof (sim_modes) / sizeof (sim_modes[0])))
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  int camera_num;
+  const SimMode *mode;
+  int width;
+  int height;
+  uint32_t stride;
+  uint32_t length;
+  uint64_t next_frame;
+  uint64_t sequence;
+
+  int exposure;
+  int gain;
+  int hflip;
+  int vflip;
+  int external_trigger;
+  int auto_exposure;
+  int auto_white_balance;
+  uint16_t regs[0x10000];
+
+  BUFFER *buffers;
+  int *in_use;
+  int n_buffers;
+  int outstanding;
+
+  unsigned int seed;
+  int latency_us;
+  int jitter_us;
+  int drop_permille;
+  int timeout_permille;
+  int trigger_us;
+}
+SimCamera;
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static SimCamera *sim_cameras[SIM_MAX_CAMERAS];
+
+static int
+sim_getenv (const char *name, int fallback)
+{
+  const char *value = getenv (name);
+  return value ? atoi (value) : fallback;
+}
+
+static uint64_t
+sim_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+sim_sleep_until (uint64_t deadline)
+{
+  struct timespec ts;
+  ts.tv_sec = deadline / 1000000;
+  ts.tv_nsec = (deadline % 1000000) * 1000;
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static int
+sim_chance (SimCamera *sim, int permille)
+{
+  return permille > 0 && (int) (rand_r (&sim->seed) % 1000) < permille;
+}
+
+static uint32_t
+sim_line_size (const SimMode *mode, int width)
+{
+  switch (mode->pixelformat)
+  {
+    case V4L2_PIX_FMT_Y10P:
+    case V4L2_PIX_FMT_SBGGR10P:
+      return width * 5 / 4;
+    default:
+      return width;
+  }
+}
+
+static void
+sim_write_reg16 (SimCamera *sim, uint16_t address, int value)
+{
+  sim->regs[address] = (value >> 8) & 0xff;
+  sim->regs[address + 1] = value & 0xff;
+}
+
+// NOTE(marcin.sielski): Mode switch loads the OV9281 timing registers, the
+// window (0x3800-0x3807), output size (0x3808-0x380B) and frame length
+// (VTS, 0x380E-0x380F) may then be reprogrammed by the caller
+static void
+sim_load_timing (SimCamera *sim)
+{
+  const SimMode *mode = sim->mode;
+
+  sim_write_reg16 (sim, 0x3800, 0);
+  sim_write_reg16 (sim, 0x3802, 0);
+  sim_write_reg16 (sim, 0x3804, mode->width + 2 * SIM_ISP_MARGIN - 1);
+  sim_write_reg16 (sim, 0x3806, mode->height + 2 * SIM_ISP_MARGIN - 1);
+  sim_write_reg16 (sim, 0x3808, mode->width);
+  sim_write_reg16 (sim, 0x380A, mode->height);
+  sim_write_reg16 (sim, 0x380C, 0x2d8);
+  sim_write_reg16 (sim, 0x380E, mode->height + SIM_VBLANK_LINES);
+  sim_write_reg16 (sim, 0x3810, SIM_ISP_MARGIN);
+  sim_write_reg16 (sim, 0x3812, SIM_ISP_MARGIN);
+}
+
+// NOTE(marcin.sielski): The sensor outputs the programmed output size as
+// long as it fits the window, which in turn has to fit the mode
+static void
+sim_update_geometry (SimCamera *sim)
+{
+  const SimMode *mode = sim->mode;
+  int window_width = SIM_REG16 (sim, 0x3804) - SIM_REG16 (sim, 0x3800) + 1 -
+    2 * SIM_ISP_MARGIN;
+  int window_height = SIM_REG16 (sim, 0x3806) - SIM_REG16 (sim, 0x3802) + 1 -
+    2 * SIM_ISP_MARGIN;
+
+  sim->width = SIM_REG16 (sim, 0x3808);
+  sim->height = SIM_REG16 (sim, 0x380A);
+  if (sim->width > window_width) sim->width = window_width;
+  if (sim->height > window_height) sim->height = window_height;
+  if (sim->width > mode->width || sim->width <= 0) sim->width = mode->width;
+  if (sim->height > mode->height || sim->height <= 0) 
+  {
+    sim->height = mode->height;
+  }
+  sim->stride = SIM_ALIGN (sim_line_size (mode, sim->width), 32);
+  sim->length = sim->stride * SIM_ALIGN (sim->height, 16);
+}
+
+static uint64_t
+sim_frame_period (SimCamera *sim)
+{
+  if (sim->external_trigger || sim->mode->etm) return sim->trigger_us;
+  // NOTE(marcin.sielski): Line time is fixed by the mode, the frame period
+  // scales with the frame length which can not be shorter than the output
+  uint64_t vts = SIM_REG16 (sim, 0x380E);
+  if (vts < (uint64_t) sim->height + 16) vts = sim->height + 16;
+  return 1000000 * vts / (sim->mode->fps * 
+    (uint64_t) (sim->mode->height + SIM_VBLANK_LINES));
+}
+
+// NOTE(marcin.sielski): Trigger pulses are shared by all cameras of the
+// process, a triggered camera waits for the next pulse on a common grid
+static uint64_t
+sim_first_frame (SimCamera *sim)
+{
+  uint64_t now = sim_now ();
+  uint64_t period = sim_frame_period (sim);
+
+  if (period && (sim->external_trigger || sim->mode->etm))
+  {
+    return (now / period + 1) * period;
+  }
+  return now + period;
+}
+
+static void
+sim_free (SimCamera *sim)
+{
+  for (int i = 0; i < sim->n_buffers; i++) free (sim->buffers[i].data);
+  free (sim->buffers);
+  free (sim->in_use);
+  pthread_mutex_destroy (&sim->lock);
+  free (sim);
+}
+
+static int
+sim_open (CAMERA_INSTANCE *camera_instance, int camera_num)
+{
+  SimCamera *sim;
+  uint32_t max_length = 0;
+
+  if (!camera_instance || camera_num < 0 || camera_num >= SIM_MAX_CAMERAS)
+    return -1;
+
+  pthread_mutex_lock (&sim_lock);
+  if (sim_cameras[camera_num])
+  {
+    pthread_mutex_unlock (&sim_lock);
+    fprintf (stderr, "arducam simulator: camera %d already open\n", 
+      camera_num);
+    return -1;
+  }
+  sim = calloc (1, sizeof (SimCamera));
+  sim_cameras[camera_num] = sim;
+  pthread_mutex_unlock (&sim_lock);
+
+  pthread_mutex_init (&sim->lock, NULL);
+  sim->camera_num = camera_num;
+  sim->exposure = SIM_EXPOSURE_DEFAULT;
+  sim->gain = 1;
+  sim->auto_exposure = 0;
+
+  sim->latency_us = sim_getenv ("ARDUCAM_SIM_LATENCY_US", 0);
+  sim->jitter_us = sim_getenv ("ARDUCAM_SIM_JITTER_US", 0);
+  sim->drop_permille = sim_getenv ("ARDUCAM_SIM_DROP_PERMILLE", 0);
+  sim->timeout_permille = sim_getenv ("ARDUCAM_SIM_TIMEOUT_PERMILLE", 0);
+  sim->trigger_us = sim_getenv ("ARDUCAM_SIM_TRIGGER_US", 1000000 / 60);
+  sim->seed = sim_getenv ("ARDUCAM_SIM_SEED", 1) + camera_num;
+  sim->n_buffers = sim_getenv ("ARDUCAM_SIM_BUFFERS", SIM_BUFFERS_DEFAULT);
+  if (sim->n_buffers < 1) sim->n_buffers = 1;
+
+  // NOTE(marcin.sielski): OV9281 chip id, revision and manual white balance
+  // registers read and written by the plugin
+  sim->regs[0x300A] = 0x92;
+  sim->regs[0x300B] = 0x81;
+  sim->regs[0x300C] = 0xa2;
+  sim->regs[0x3400] = 0x04;
+  sim->regs[0x3402] = 0x04;
+  sim->regs[0x3404] = 0x04;
+  sim->regs[0x3406] = 0x00;
+
+  // NOTE(marcin.sielski): Buffers are sized for the largest mode so that
+  // switching modes never reallocates memory still held by the caller
+  for (int i = 0; i < SIM_N_MODES; i++)
+  {
+    uint32_t length = 
+      SIM_ALIGN (sim_line_size (&sim_modes[i], sim_modes[i].width), 32) * 
+      SIM_ALIGN (sim_modes[i].height, 16);
+    if (length > max_length) max_length = length;
+  }
+  sim->buffers = calloc (sim->n_buffers, sizeof (BUFFER));
+  sim->in_use = calloc (sim->n_buffers, sizeof (int));
+  for (int i = 0; i < sim->n_buffers; i++)
+  {
+    sim->buffers[i].priv = sim;
+    sim->buffers[i].data = malloc (max_length);
+    sim->buffers[i].alloc_size = max_length;
+  }
+
+  *camera_instance = sim;
+  return 0;
+}
+
+int
+arducam_init_camera (CAMERA_INSTANCE *camera_instance)
+{
+  return sim_open (camera_instance, 0);
+}
+
+int
+arducam_init_camera2 (CAMERA_INSTANCE *camera_instance,
+    struct camera_interface cam_interface)
+{
+  return sim_open (camera_instance, cam_interface.camera_num);
+}
+
+int
+arducam_close_camera (CAMERA_INSTANCE camera_instance)
+{
+  SimCamera *sim = camera_instance;
+  int outstanding;
+
+  if (!sim) return -1;
+
+  pthread_mutex_lock (&sim->lock);
+  outstanding = sim->outstanding;
+  pthread_mutex_unlock (&sim->lock);
+
+  // NOTE(marcin.sielski): The SDK frees the buffers on close, buffers still
+  // held by the caller would point to freed memory
+  if (outstanding)
+  {
+    fprintf (stderr, "arducam simulator: camera %d closed with %d buffers "
+      "outstanding\n", sim->camera_num, outstanding);
+    abort ();
+  }
+
+  pthread_mutex_lock (&sim_lock);
+  sim_cameras[sim->camera_num] = NULL;
+  pthread_mutex_unlock (&sim_lock);
+  sim_free (sim);
+  return 0;
+}
+
+int
+arducam_set_mode (CAMERA_INSTANCE camera_instance, int mode)
+{
+  SimCamera *sim = camera_instance;
+
+  if (!sim || mode < 0 || mode >= SIM_N_MODES) return -1;
+
+  pthread_mutex_lock (&sim->lock);
+  sim->mode = &sim_modes[mode];
+  sim_load_timing (sim);
+  sim_update_geometry (sim);
+  for (int i = 0; i < sim->n_buffers; i++)
+  {
+    if (sim->in_use[i]) continue;
+    for (uint32_t y = 0; y < sim->length / sim->stride; y++)
+    {
+      for (uint32_t x = 0; x < sim->stride; x++)
+      {
+        sim->buffers[i].data[y * sim->stride + x] = (uint8_t) (x + y);
+      }
+    }
+  }
+  sim->next_frame = sim_first_frame (sim);
+  pthread_mutex_unlock (&sim->lock);
+  return 0;
+}
+
+int
+arducam_set_resolution (CAMERA_INSTANCE camera_instance, int *width,
+    int *height)
+{
+  if (!width || !height) return -1;
+  for (int i = 0; i < SIM_N_MODES; i++)
+  {
+    if (sim_modes[i].width == *width && sim_modes[i].height == *height &&
+      !sim_modes[i].etm && sim_modes[i].pixelformat == V4L2_PIX_FMT_GREY)
+    {
+      return arducam_set_mode (camera_instance, i);
+    }
+  }
+  return -1;
+}
+
+static void
+sim_fill_format (struct format *fmt, int index)
+{
+  fmt->mode = index;
+  fmt->width = sim_modes[index].width;
+  fmt->height = sim_modes[index].height;
+  fmt->pixelformat = sim_modes[index].pixelformat;
+  fmt->description = sim_modes[index].description;
+}
+
+int
+arducam_get_format (CAMERA_INSTANCE camera_instance, struct format *fmt)
+{
+  SimCamera *sim = camera_instance;
+  if (!sim || !fmt || !sim->mode) return -1;
+  sim_fill_format (fmt, (int) (sim->mode - sim_modes));
+  return 0;
+}
+
+int
+arducam_get_support_formats (CAMERA_INSTANCE camera_instance,
+    struct format *fmt, int index)
+{
+  if (!camera_instance || !fmt || index < 0 || index >= SIM_N_MODES) 
+    return -1;
+  sim_fill_format (fmt, index);
+  return 0;
+}
+
+BUFFER *
+arducam_capture (CAMERA_INSTANCE camera_instance, IMAGE_FORMAT *format,
+    int timeout)
+{
+  SimCamera *sim = camera_instance;
+  BUFFER *buffer = NULL;
+  uint64_t now, deadline, period, ready;
+  int free_buffers = 0;
+
+  (void) format;
+  if (!sim) return NULL;
+
+  now = sim_now ();
+  deadline = now + (uint64_t) timeout * 1000;
+
+  pthread_mutex_lock (&sim->lock);
+  if (!sim->mode)
+  {
+    pthread_mutex_unlock (&sim->lock);
+    return NULL;
+  }
+  period = sim_frame_period (sim);
+  for (int i = 0; i < sim->n_buffers; i++)
+  {
+    if (!sim->in_use[i])
+    {
+      if (!buffer) buffer = &sim->buffers[i];
+      free_buffers++;
+    }
+  }
+  if (!period || !buffer || sim_chance (sim, sim->timeout_permille))
+  {
+    pthread_mutex_unlock (&sim->lock);
+    sim_sleep_until (deadline);
+    return NULL;
+  }
+  // NOTE(marcin.sielski): The sensor free runs, frames completed while
+  // nobody was capturing are queued as long as there are free buffers and
+  // lost otherwise
+  if (now > sim->next_frame)
+  {
+    uint64_t backlog = (now - sim->next_frame) / period + 1;
+    if (backlog > (uint64_t) free_buffers)
+    {
+      sim->next_frame += (backlog - free_buffers) * period;
+      sim->sequence += backlog - free_buffers;
+    }
+  }
+  while (sim_chance (sim, sim->drop_permille))
+  {
+    sim->next_frame += period;
+    sim->sequence++;
+  }
+  ready = sim->next_frame + sim->latency_us;
+  if (sim->jitter_us)
+  {
+    ready += rand_r (&sim->seed) % (2 * sim->jitter_us + 1);
+    ready = ready > (uint64_t) sim->jitter_us ? ready - sim->jitter_us : 0;
+  }
+  if (ready > deadline)
+  {
+    pthread_mutex_unlock (&sim->lock);
+    sim_sleep_until (deadline);
+    return NULL;
+  }
+  sim->in_use[buffer - sim->buffers] = 1;
+  sim->outstanding++;
+  buffer->length = sim->length;
+  buffer->pts = sim->next_frame;
+  buffer->flags = 0;
+  memcpy (buffer->data, &sim->sequence, sizeof (sim->sequence));
+  sim->next_frame += period;
+  sim->sequence++;
+  if (sim->auto_exposure)
+  {
+    sim->exposure = SIM_EXPOSURE_DEFAULT + (int) (sim->sequence % 64);
+  }
+  pthread_mutex_unlock (&sim->lock);
+
+  sim_sleep_until (ready);
+  return buffer;
+}
+
+void
+arducam_release_buffer (BUFFER *buffer)
+{
+  SimCamera *sim;
+
+  if (!buffer || !buffer->priv) return;
+  sim = buffer->priv;
+
+  pthread_mutex_lock (&sim->lock);
+  sim->in_use[buffer - sim->buffers] = 0;
+  sim->outstanding--;
+  pthread_mutex_unlock (&sim->lock);
+}
+
+int
+arducam_set_control (CAMERA_INSTANCE camera_instance, int ctrl_id, int value)
+{
+  SimCamera *sim = camera_instance;
+  int ret = 0;
+
+  if (!sim) return -1;
+
+  pthread_mutex_lock (&sim->lock);
+  switch (ctrl_id)
+  {
+    case V4L2_CID_EXPOSURE:
+      sim->exposure = value;
+      break;
+    case V4L2_CID_GAIN:
+      sim->gain = value;
+      break;
+    case V4L2_CID_HFLIP:
+      sim->hflip = value;
+      break;
+    case V4L2_CID_VFLIP:
+      sim->vflip = value;
+      break;
+    case V4L2_CID_ARDUCAM_EXT_TRI:
+      sim->external_trigger = value;
+      if (sim->mode) sim->next_frame = sim_first_frame (sim);
+      break;
+    default:
+      ret = -1;
+      break;
+  }
+  pthread_mutex_unlock (&sim->lock);
+  return ret;
+}
+
+int
+arducam_get_control (CAMERA_INSTANCE camera_instance, int ctrl_id,
+    int *value)
+{
+  SimCamera *sim = camera_instance;
+  int ret = 0;
+
+  if (!sim || !value) return -1;
+
+  pthread_mutex_lock (&sim->lock);
+  switch (ctrl_id)
+  {
+    case V4L2_CID_EXPOSURE:
+      *value = sim->exposure;
+      break;
+    case V4L2_CID_GAIN:
+      *value = sim->gain;
+      break;
+    case V4L2_CID_HFLIP:
+      *value = sim->hflip;
+      break;
+    case V4L2_CID_VFLIP:
+      *value = sim->vflip;
+      break;
+    case V4L2_CID_ARDUCAM_EXT_TRI:
+      *value = sim->external_trigger;
+      break;
+    default:
+      ret = -1;
+      break;
+  }
+  pthread_mutex_unlock (&sim->lock);
+  return ret;
+}
+
+int
+arducam_reset_control (CAMERA_INSTANCE camera_instance, int ctrl_id)
+{
+  switch (ctrl_id)
+  {
+    case V4L2_CID_EXPOSURE:
+      return arducam_set_control (camera_instance, ctrl_id, 
+        SIM_EXPOSURE_DEFAULT);
+    case V4L2_CID_GAIN:
+      return arducam_set_control (camera_instance, ctrl_id, 1);
+    default:
+      return arducam_set_control (camera_instance, ctrl_id, 0);
+  }
+}
+
+int
+arducam_write_sensor_reg (CAMERA_INSTANCE camera_instance, uint16_t address,
+    uint16_t value)
+{
+  SimCamera *sim = camera_instance;
+  if (!sim) return -1;
+  pthread_mutex_lock (&sim->lock);
+  sim->regs[address] = value;
+  if (sim->mode && address >= 0x3800 && address <= 0x380F) 
+  {
+    sim_update_geometry (sim);
+  }
+  pthread_mutex_unlock (&sim->lock);
+  return 0;
+}
+
+int
+arducam_read_sensor_reg (CAMERA_INSTANCE camera_instance, uint16_t address,
+    uint16_t *value)
+{
+  SimCamera *sim = camera_instance;
+  if (!sim || !value) return -1;
+  pthread_mutex_lock (&sim->lock);
+  *value = sim->regs[address];
+  pthread_mutex_unlock (&sim->lock);
+  return 0;
+}
+
+int
+arducam_software_auto_exposure (CAMERA_INSTANCE camera_instance, int enable)
+{
+  SimCamera *sim = camera_instance;
+  if (!sim) return -1;
+  pthread_mutex_lock (&sim->lock);
+  sim->auto_exposure = enable;
+  pthread_mutex_unlock (&sim->lock);
+  return 0;
+}
+
+int
+arducam_software_auto_white_balance (CAMERA_INSTANCE camera_instance,
+    int enable)
+{
+  SimCamera *sim = camera_instance;
+  if (!sim) return -1;
+  pthread_mutex_lock (&sim->lock);
+  sim->auto_white_balance = enable;
+  sim->regs[0x3406] = enable ? 0x0 : 0x1;
+  pthread_mutex_unlock (&sim->lock);
+  return 0;
+}
+
+int
+arducam_sim_get_outstanding (int camera_num)
+{
+  SimCamera *sim;
+  int outstanding = -1;
+
+  if (camera_num < 0 || camera_num >= SIM_MAX_CAMERAS) return -1;
+
+  pthread_mutex_lock (&sim_lock);
+  sim = sim_cameras[camera_num];
+  if (sim)
+  {
+    pthread_mutex_lock (&sim->lock);
+    outstanding = sim->outstanding;
+    pthread_mutex_unlock (&sim->lock);
+  }
+  pthread_mutex_unlock (&sim_lock);
+  return outstanding;
+}
+
+int
+arducam_sim_read_reg (int camera_num, uint16_t address, uint16_t *value)
+{
+  int ret = -1;
+
+  if (camera_num < 0 || camera_num >= SIM_MAX_CAMERAS) return -1;
+
+  pthread_mutex_lock (&sim_lock);
+  if (sim_cameras[camera_num])
+  {
+    ret = arducam_read_sensor_reg (sim_cameras[camera_num], address, value);
+  }
+  pthread_mutex_unlock (&sim_lock);
+  return ret;
+}
+
+int
+arducam_sim_is_capture_buffer (const void *data, size_t size)
+{
+  const uint8_t *begin = data;
+  int found = 0;
+
+  pthread_mutex_lock (&sim_lock);
+  for (int i = 0; i < SIM_MAX_CAMERAS && !found; i++)
+  {
+    SimCamera *sim = sim_cameras[i];
+    if (!sim) continue;
+    for (int j = 0; j < sim->n_buffers && !found; j++)
+    {
+      const BUFFER *buffer = &sim->buffers[j];
+      found = begin >= buffer->data && 
+        begin + size <= buffer->data + buffer->alloc_size;
+    }
+  }
+  pthread_mutex_unlock (&sim_lock);
+  return found;
+}
@@ -0,0 +1,149 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+/*
+ * Simulator of the Arducam MIPI_Camera SDK (arducam_mipicamera) API surface
+ * used by arducamsrc. It allows building and benchmarking the plugin on
+ * machines without the camera hardware (./configure --enable-simulator).
+ *
+ * The simulated camera is an OV9281 exposing the same 23 sensor modes as the
+ * SDK with matching resolution, pixel format and frame period. The window,
+ * output size and frame length (VTS) registers 0x3800-0x380F are honored,
+ * so frames shrink and the frame period follows the programmed VTS at the
+ * line time of the mode. Closing a camera while capture buffers are not
+ * released aborts, as the SDK frees them on close. Its behavior is tuned 
+ * with the following environment variables:
+ *
+ *   ARDUCAM_SIM_LATENCY_US      delay between end of frame and capture return
+ *   ARDUCAM_SIM_JITTER_US       maximum random deviation of the frame period
+ *   ARDUCAM_SIM_DROP_PERMILLE   probability of a sensor frame being lost
+ *   ARDUCAM_SIM_TIMEOUT_PERMILLE probability of a capture call timing out
+ *   ARDUCAM_SIM_TRIGGER_US      external trigger period, 0 = never triggered,
+ *                               the pulse is shared by all cameras
+ *   ARDUCAM_SIM_BUFFERS         number of capture buffers (default 4)
+ *   ARDUCAM_SIM_SEED            seed of the random generator
+ */
+
+#ifndef __ARDUCAM_MIPICAMERA_H__
+#define __ARDUCAM_MIPICAMERA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/v4l2-controls.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MMAL_FOURCC(a, b, c, d) \
+  ((a) | ((b) << 8) | ((c) << 16) | ((uint32_t) (d) << 24))
+
+#define IMAGE_ENCODING_I420 MMAL_FOURCC ('I', '4', '2', '0')
+#define IMAGE_ENCODING_JPEG MMAL_FOURCC ('J', 'P', 'E', 'G')
+#define IMAGE_ENCODING_RAW_BAYER MMAL_FOURCC ('B', 'A', 'Y', 'R')
+
+#define V4L2_CID_ARDUCAM_BASE (V4L2_CID_USER_BASE + 0x1f00)
+#define V4L2_CID_ARDUCAM_EXT_TRI (V4L2_CID_ARDUCAM_BASE + 1)
+
+typedef void *CAMERA_INSTANCE;
+
+typedef struct
+{
+  uint32_t encoding;
+  int quality;
+}
+IMAGE_FORMAT;
+
+typedef struct
+{
+  void *priv;
+  uint8_t *data;
+  uint32_t alloc_size;
+  uint32_t length;
+  uint32_t flags;
+  uint64_t pts;
+  void *userdata;
+}
+BUFFER;
+
+struct format
+{
+  int mode;
+  int width;
+  int height;
+  uint32_t pixelformat;
+  const char *description;
+};
+
+struct camera_interface
+{
+  int i2c_bus;
+  int camera_num;
+  int sda_pins[2];
+  int scl_pins[2];
+  int led_pins[2];
+  int shutdown_pins[2];
+};
+
+int arducam_init_camera (CAMERA_INSTANCE *camera_instance);
+int arducam_init_camera2 (CAMERA_INSTANCE *camera_instance,
+    struct camera_interface cam_interface);
+int arducam_close_camera (CAMERA_INSTANCE camera_instance);
+int arducam_set_mode (CAMERA_INSTANCE camera_instance, int mode);
+int arducam_set_resolution (CAMERA_INSTANCE camera_instance, int *width,
+    int *height);
+int arducam_get_format (CAMERA_INSTANCE camera_instance, struct format *fmt);
+int arducam_get_support_formats (CAMERA_INSTANCE camera_instance,
+    struct format *fmt, int index);
+BUFFER *arducam_capture (CAMERA_INSTANCE camera_instance, IMAGE_FORMAT *format,
+    int timeout);
+void arducam_release_buffer (BUFFER *buffer);
+int arducam_set_control (CAMERA_INSTANCE camera_instance, int ctrl_id,
+    int value);
+int arducam_get_control (CAMERA_INSTANCE camera_instance, int ctrl_id,
+    int *value);
+int arducam_reset_control (CAMERA_INSTANCE camera_instance, int ctrl_id);
+int arducam_write_sensor_reg (CAMERA_INSTANCE camera_instance,
+    uint16_t address, uint16_t value);
+int arducam_read_sensor_reg (CAMERA_INSTANCE camera_instance,
+    uint16_t address, uint16_t *value);
+int arducam_software_auto_exposure (CAMERA_INSTANCE camera_instance,
+    int enable);
+int arducam_software_auto_white_balance (CAMERA_INSTANCE camera_instance,
+    int enable);
+
+/*
+ * Simulator only, lets the tests inspect the simulated cameras. Functions
+ * return -1 when the camera is not open.
+ */
+int arducam_sim_get_outstanding (int camera_num);
+int arducam_sim_read_reg (int camera_num, uint16_t address, uint16_t *value);
+/* 1 when the memory is part of a capture buffer of an open camera */
+int arducam_sim_is_capture_buffer (const void *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ARDUCAM_MIPICAMERA_H__ */
@@ -0,0 +1,91 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+/*
+ * Captures frames of mode 4 (160x100 at 480 fps) of the simulated (or 
+ * attached) OV9281 with batch-size 1, 4 and 16, the CPU time per frame shows
+ * what pushing buffer lists saves.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "benchmark.h"
+
+static const gint batch_sizes[] = { 1, 4, 16 };
+
+int
+main (int argc, char *argv[])
+{
+  gint num_buffers = 4800;
+  gchar *json = NULL;
+  GOptionEntry entries[] = {
+    { "num-buffers", 'n', 0, G_OPTION_ARG_INT, &num_buffers, 
+      "Frames captured per run", "N" },
+    { "json", 'j', 0, G_OPTION_ARG_FILENAME, &json, 
+      "Write the results as JSON to FILE", "FILE" },
+    { NULL }
+  };
+  GOptionContext *context = g_option_context_new ("- benchmark batching");
+  GError *error = NULL;
+  GPtrArray *results;
+  gint ret = 0;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  results = 
+    g_ptr_array_new_with_free_func ((GDestroyNotify) gst_structure_free);
+  for (guint i = 0; i < G_N_ELEMENTS (batch_sizes); i++)
+  {
+    // NOTE(marcin.sielski): num-buffers counts create() calls, each of which
+    // returns a whole batch. batch-time=0 waits for full batches.
+    gchar *name = g_strdup_printf ("batch-size-%d", batch_sizes[i]);
+    gchar *description = g_strdup_printf ("arducamsrc name=src "
+      "num-buffers=%d batch-size=%d batch-time=0 ! "
+      "video/x-raw,sensor-mode=4 ! fakesink sync=false", 
+      MAX (1, num_buffers / batch_sizes[i]), batch_sizes[i]);
+    GstStructure *result = benchmark_run (name, description);
+
+    if (result) g_ptr_array_add (results, result);
+    else ret = 1;
+    g_free (description);
+    g_free (name);
+  }
+
+  if (!benchmark_report (results, json)) ret = 1;
+
+  g_ptr_array_unref (results);
+  g_free (json);
+
+  return ret;
+}
@@ -0,0 +1,191 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <sys/resource.h>
+#include "benchmark.h"
+
+#define BENCHMARK_TIMEOUT (120 * GST_SECOND)
+
+static gint64
+benchmark_cpu_time (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+  return (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 
+    G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static gboolean
+benchmark_copy_field (GQuark field, const GValue * value, gpointer data)
+{
+  gst_structure_id_set_value (data, field, value);
+  return TRUE;
+}
+
+// NOTE(marcin.sielski): Runs the pipeline to EOS and returns the statistics
+// of the element named src preceded by the name of the run and followed by
+// the CPU time (user and system, in microseconds) of the process spent per
+// frame, NULL on failure
+GstStructure *
+benchmark_run (const gchar * name, const gchar * description)
+{
+  GError *error = NULL;
+  GstElement *pipeline = gst_parse_launch (description, &error);
+  GstElement *src;
+  GstBus *bus;
+  GstMessage *message;
+  GstStructure *stats = NULL;
+  GstStructure *result = NULL;
+  gint64 cpu_time;
+
+  if (!pipeline)
+  {
+    g_printerr ("%s: %s\n", name, error->message);
+    g_error_free (error);
+    return NULL;
+  }
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  bus = gst_element_get_bus (pipeline);
+
+  cpu_time = benchmark_cpu_time ();
+  if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == 
+    GST_STATE_CHANGE_FAILURE)
+  {
+    g_printerr ("%s: could not start %s\n", name, description);
+    goto done;
+  }
+  message = gst_bus_timed_pop_filtered (bus, BENCHMARK_TIMEOUT, 
+    GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  cpu_time = benchmark_cpu_time () - cpu_time;
+  if (!message)
+  {
+    g_printerr ("%s: timeout\n", name);
+    goto done;
+  }
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR)
+  {
+    gst_message_parse_error (message, &error, NULL);
+    g_printerr ("%s: %s\n", name, error->message);
+    g_error_free (error);
+  }
+  else
+  {
+    guint64 frames = 0;
+
+    g_object_get (src, "stats", &stats, NULL);
+    gst_structure_get_uint64 (stats, "frames", &frames);
+    result = gst_structure_new ("benchmark", "name", G_TYPE_STRING, name, 
+      NULL);
+    gst_structure_foreach (stats, benchmark_copy_field, result);
+    gst_structure_set (result, 
+      "cpu-time", G_TYPE_INT64, cpu_time,
+      "cpu-time-per-frame", G_TYPE_DOUBLE, 
+        frames ? (gdouble) cpu_time / frames : 0.0,
+      NULL);
+    gst_structure_free (stats);
+  }
+  gst_message_unref (message);
+
+done:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+  gst_object_unref (src);
+  gst_object_unref (pipeline);
+
+  return result;
+}
+
+// NOTE(marcin.sielski): Strings are quoted, numbers are written as they are
+// serialized
+static gchar *
+benchmark_value (const GValue * value)
+{
+  if (G_VALUE_HOLDS_STRING (value))
+  {
+    gchar *escaped = g_strescape (g_value_get_string (value), NULL);
+    gchar *quoted = g_strdup_printf ("\"%s\"", escaped);
+    g_free (escaped);
+    return quoted;
+  }
+  return gst_value_serialize (value);
+}
+
+// NOTE(marcin.sielski): Writes the results as CSV to stdout, a line per run
+// with the fields of the first run as the header, and as an array of JSON 
+// objects to the json file if given
+gboolean
+benchmark_report (GPtrArray * results, const gchar * json)
+{
+  GString *csv = g_string_new (NULL);
+  GString *objects = g_string_new ("[\n");
+  GError *error = NULL;
+  gboolean ret = TRUE;
+
+  for (guint i = 0; i < results->len; i++)
+  {
+    GstStructure *result = g_ptr_array_index (results, i);
+    gint fields = gst_structure_n_fields (result);
+
+    if (!i)
+    {
+      for (gint j = 0; j < fields; j++)
+      {
+        g_string_append_printf (csv, "%s%s", j ? "," : "", 
+          gst_structure_nth_field_name (result, j));
+      }
+      g_string_append_c (csv, '\n');
+    }
+    g_string_append (objects, "  {");
+    for (gint j = 0; j < fields; j++)
+    {
+      const gchar *field = gst_structure_nth_field_name (result, j);
+      gchar *value = benchmark_value (gst_structure_get_value (result, field));
+      g_string_append_printf (csv, "%s%s", j ? "," : "", value);
+      g_string_append_printf (objects, "%s\"%s\": %s", j ? ", " : " ", field, 
+        value);
+      g_free (value);
+    }
+    g_string_append_c (csv, '\n');
+    g_string_append_printf (objects, " }%s\n", i + 1 < results->len ? "," : "");
+  }
+  g_string_append (objects, "]\n");
+
+  g_print ("%s", csv->str);
+  if (json && !g_file_set_contents (json, objects->str, -1, &error))
+  {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    ret = FALSE;
+  }
+
+  g_string_free (csv, TRUE);
+  g_string_free (objects, TRUE);
+
+  return ret;
+}
@@ -0,0 +1,108 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+/*
+ * Captures num-buffers 1280x800 bayer frames of the simulated (or attached)
+ * OV9281 and converts them to RGB with the demosaic of the element, with
+ * one thread and with the default number, and with bayer2rgb.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "benchmark.h"
+
+static const struct
+{
+  const gchar *name;
+  const gchar *pipeline;
+}
+runs[] = {
+  { "demosaic-1-thread", "arducamsrc name=src num-buffers=%d demosaic=true "
+    "demosaic-threads=1 ! video/x-raw,format=RGB,sensor-mode=21 ! "
+    "fakesink sync=false" },
+  { "demosaic", "arducamsrc name=src num-buffers=%d demosaic=true ! "
+    "video/x-raw,format=RGB,sensor-mode=21 ! fakesink sync=false" },
+  { "demosaic-gray8", "arducamsrc name=src num-buffers=%d demosaic=true ! "
+    "video/x-raw,format=GRAY8,sensor-mode=21 ! fakesink sync=false" },
+  { "bayer2rgb", "arducamsrc name=src num-buffers=%d ! "
+    "video/x-bayer,sensor-mode=21 ! bayer2rgb ! fakesink sync=false" },
+};
+
+int
+main (int argc, char *argv[])
+{
+  gint num_buffers = 300;
+  gchar *json = NULL;
+  GOptionEntry entries[] = {
+    { "num-buffers", 'n', 0, G_OPTION_ARG_INT, &num_buffers, 
+      "Frames captured per run", "N" },
+    { "json", 'j', 0, G_OPTION_ARG_FILENAME, &json, 
+      "Write the results as JSON to FILE", "FILE" },
+    { NULL }
+  };
+  GOptionContext *context = g_option_context_new ("- benchmark demosaic");
+  GError *error = NULL;
+  GPtrArray *results;
+  gint ret = 0;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  results = 
+    g_ptr_array_new_with_free_func ((GDestroyNotify) gst_structure_free);
+  for (guint i = 0; i < G_N_ELEMENTS (runs); i++)
+  {
+    // NOTE(marcin.sielski): bayer2rgb comes with gst-plugins-bad which may
+    // not be installed
+    if (g_str_equal (runs[i].name, "bayer2rgb") && 
+      !gst_registry_check_feature_version (gst_registry_get (), "bayer2rgb", 
+        1, 0, 0))
+    {
+      g_printerr ("%s: not installed, skipped\n", runs[i].name);
+      continue;
+    }
+    gchar *description = g_strdup_printf (runs[i].pipeline, num_buffers);
+    GstStructure *result = benchmark_run (runs[i].name, description);
+
+    if (result) g_ptr_array_add (results, result);
+    else ret = 1;
+    g_free (description);
+  }
+
+  if (!benchmark_report (results, json)) ret = 1;
+
+  g_ptr_array_unref (results);
+  g_free (json);
+
+  return ret;
+}
@@ -0,0 +1,95 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+/*
+ * Captures num-buffers frames in every sensor mode of the simulated (or 
+ * attached) OV9281 and reports the statistics of the element per mode.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "benchmark.h"
+#include "modes.h"
+
+int
+main (int argc, char *argv[])
+{
+  gint num_buffers = 300;
+  gchar *json = NULL;
+  GOptionEntry entries[] = {
+    { "num-buffers", 'n', 0, G_OPTION_ARG_INT, &num_buffers, 
+      "Frames captured per sensor mode", "N" },
+    { "json", 'j', 0, G_OPTION_ARG_FILENAME, &json, 
+      "Write the results as JSON to FILE", "FILE" },
+    { NULL }
+  };
+  GOptionContext *context = g_option_context_new ("- benchmark sensor modes");
+  GError *error = NULL;
+  GPtrArray *results;
+  gint ret = 0;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  results = 
+    g_ptr_array_new_with_free_func ((GDestroyNotify) gst_structure_free);
+  for (guint i = 0; i < G_N_ELEMENTS (test_modes); i++)
+  {
+    gchar *name = g_strdup_printf ("mode-%d", test_modes[i].mode);
+    gchar *description = g_strdup_printf ("arducamsrc name=src "
+      "num-buffers=%d external-trigger=%s ! %s,sensor-mode=%d ! "
+      "fakesink sync=false", num_buffers, test_modes[i].etm ? "true" : "false",
+      test_modes[i].caps, test_modes[i].mode);
+    GstStructure *result = benchmark_run (name, description);
+
+    if (result) 
+    {
+      gst_structure_set (result, "caps", G_TYPE_STRING, test_modes[i].caps, 
+        NULL);
+      g_ptr_array_add (results, result);
+    }
+    else
+    {
+      ret = 1;
+    }
+    g_free (description);
+    g_free (name);
+  }
+
+  if (!benchmark_report (results, json)) ret = 1;
+
+  g_ptr_array_unref (results);
+  g_free (json);
+
+  return ret;
+}
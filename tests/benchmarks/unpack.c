@@ -0,0 +1,127 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+/*
+ * Unpacks num-buffers 1280x800 RAW10 frames, as delivered by the 10-bit 
+ * sensor modes, with every kernel usable on this CPU and reports the time
+ * per frame of each.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "benchmark.h"
+#include "arducamunpack.h"
+
+#define WIDTH 1280
+#define HEIGHT 800
+
+typedef void (*UnpackFunc) (const guint8 * src, guint16 * dst, guint width);
+
+static GstStructure *
+unpack_run (const gchar * implementation, const gchar * format, 
+    UnpackFunc unpack, const guint8 * frame, guint16 * out, gint frames)
+{
+  gsize stride = GST_ROUND_UP_32 (ARDUCAM_RAW10_LINE_SIZE (WIDTH));
+  gint64 begin, elapsed;
+
+  arducam_unpack_set_implementation (implementation);
+  begin = g_get_monotonic_time ();
+  for (gint i = 0; i < frames; i++)
+  {
+    for (guint y = 0; y < HEIGHT; y++)
+    {
+      unpack (frame + y * stride, out + y * WIDTH, WIDTH);
+    }
+  }
+  elapsed = g_get_monotonic_time () - begin;
+
+  gchar *name = g_strdup_printf ("%s-%s", format, implementation);
+  GstStructure *result = gst_structure_new ("benchmark", 
+    "name", G_TYPE_STRING, name,
+    "implementation", G_TYPE_STRING, implementation,
+    "format", G_TYPE_STRING, format,
+    "frames", G_TYPE_UINT64, (guint64) frames,
+    "time-per-frame", G_TYPE_DOUBLE, frames ? (gdouble) elapsed / frames : 0.0,
+    "megapixels-per-second", G_TYPE_DOUBLE, elapsed ? 
+      (gdouble) WIDTH * HEIGHT * frames / elapsed : 0.0,
+    NULL);
+  g_free (name);
+
+  return result;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint num_buffers = 300;
+  gchar *json = NULL;
+  GOptionEntry entries[] = {
+    { "num-buffers", 'n', 0, G_OPTION_ARG_INT, &num_buffers, 
+      "Frames unpacked per kernel", "N" },
+    { "json", 'j', 0, G_OPTION_ARG_FILENAME, &json, 
+      "Write the results as JSON to FILE", "FILE" },
+    { NULL }
+  };
+  GOptionContext *context = g_option_context_new ("- benchmark unpacking");
+  GError *error = NULL;
+  GPtrArray *results;
+  gint ret = 0;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  results = 
+    g_ptr_array_new_with_free_func ((GDestroyNotify) gst_structure_free);
+
+  gsize size = GST_ROUND_UP_32 (ARDUCAM_RAW10_LINE_SIZE (WIDTH)) * HEIGHT;
+  guint8 *frame = g_malloc (size);
+  guint16 *out = g_new (guint16, WIDTH * HEIGHT);
+  for (gsize i = 0; i < size; i++) frame[i] = (guint8) g_random_int ();
+  const gchar **implementations = arducam_unpack_implementations ();
+  for (guint i = 0; implementations[i]; i++)
+  {
+    g_ptr_array_add (results, unpack_run (implementations[i], "gray16", 
+      arducam_unpack_raw10_to_gray16, frame, out, num_buffers));
+    g_ptr_array_add (results, unpack_run (implementations[i], "bayer16", 
+      arducam_unpack_raw10_to_bayer16, frame, out, num_buffers));
+  }
+  g_free (out);
+  g_free (frame);
+
+  if (!benchmark_report (results, json)) ret = 1;
+
+  g_ptr_array_unref (results);
+  g_free (json);
+
+  return ret;
+}
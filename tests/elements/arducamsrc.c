@@ -0,0 +1,824 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/check/gstcheck.h>
+#include "sim/arducam_mipicamera.h"
+#include "gstarducammeta.h"
+#include "modes.h"
+
+#define NUM_BUFFERS 10
+
+static GstElement *
+parse_pipeline (const gchar * description)
+{
+  GError *error = NULL;
+  GstElement *pipeline = gst_parse_launch (description, &error);
+
+  fail_unless (pipeline != NULL, "Could not create %s: %s", description,
+    error ? error->message : "");
+
+  return pipeline;
+}
+
+// NOTE(marcin.sielski): Runs the pipeline to EOS, the pipeline is left in
+// PLAYING
+static void
+play_pipeline (GstElement * pipeline)
+{
+  GstBus *bus = gst_element_get_bus (pipeline);
+  GstMessage *message;
+  GError *error = NULL;
+
+  fail_if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == 
+    GST_STATE_CHANGE_FAILURE, "Could not start %s", GST_OBJECT_NAME (pipeline));
+  message = gst_bus_timed_pop_filtered (bus, 30 * GST_SECOND, 
+    GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  fail_unless (message != NULL, "Timeout in %s", GST_OBJECT_NAME (pipeline));
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR)
+  {
+    gst_message_parse_error (message, &error, NULL);
+    fail ("Error in %s: %s", GST_OBJECT_NAME (pipeline), error->message);
+  }
+  gst_message_unref (message);
+  gst_object_unref (bus);
+}
+
+// NOTE(marcin.sielski): Shuts the pipeline down and returns the statistics
+// of the element named src
+static GstStructure *
+stop_pipeline (GstElement * pipeline)
+{
+  GstElement *src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  GstStructure *stats = NULL;
+
+  fail_unless (src != NULL);
+  g_object_get (src, "stats", &stats, NULL);
+  fail_unless (stats != NULL);
+  fail_unless_equals_int (gst_element_set_state (pipeline, GST_STATE_NULL), 
+    GST_STATE_CHANGE_SUCCESS);
+
+  gst_object_unref (src);
+  gst_object_unref (pipeline);
+
+  return stats;
+}
+
+// NOTE(marcin.sielski): Runs the pipeline to EOS and returns the statistics
+// of the element named src
+static GstStructure *
+run_pipeline (const gchar * description)
+{
+  GstElement *pipeline = parse_pipeline (description);
+
+  play_pipeline (pipeline);
+  return stop_pipeline (pipeline);
+}
+
+// NOTE(marcin.sielski): Frames seen by the element named sink, the first
+// one is held until the test releases it
+typedef struct
+{
+  guint buffers;
+  guint copies;
+  guint wrong_size;
+  gsize size;
+  GstBuffer *held;
+}
+TestFrames;
+
+static void
+test_frames_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad, 
+    gpointer data)
+{
+  TestFrames *frames = data;
+  GstMapInfo map;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ)) return;
+  if (!arducam_sim_is_capture_buffer (map.data, map.size)) frames->copies++;
+  if (map.size != frames->size) frames->wrong_size++;
+  gst_buffer_unmap (buffer, &map);
+  if (!frames->buffers++) frames->held = gst_buffer_ref (buffer);
+}
+
+static void
+test_frames_connect (GstElement * pipeline, TestFrames * frames)
+{
+  GstElement *sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+
+  fail_unless (sink != NULL);
+  g_object_set (sink, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (test_frames_handoff), 
+    frames);
+  gst_object_unref (sink);
+}
+
+GST_START_TEST (test_sensor_modes)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (test_modes); i++)
+  {
+    gchar *description = g_strdup_printf ("arducamsrc name=src "
+      "num-buffers=%d external-trigger=%s ! %s,sensor-mode=%d ! "
+      "fakesink sync=false", NUM_BUFFERS, test_modes[i].etm ? "true" : "false",
+      test_modes[i].caps, test_modes[i].mode);
+    GstStructure *stats = run_pipeline (description);
+    guint64 frames = 0;
+    gint sensor_mode = -1;
+    gdouble fps = 0.0;
+
+    GST_INFO ("%s: %" GST_PTR_FORMAT, description, stats);
+    fail_unless (gst_structure_get_int (stats, "sensor-mode", &sensor_mode));
+    fail_unless_equals_int (sensor_mode, test_modes[i].mode);
+    fail_unless (gst_structure_get_uint64 (stats, "frames", &frames));
+    fail_unless_equals_uint64 (frames, NUM_BUFFERS);
+    fail_unless (gst_structure_get_double (stats, "fps", &fps));
+    fail_unless (fps > 0.0, "No frame rate in %s", description);
+
+    gst_structure_free (stats);
+    g_free (description);
+  }
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Mode 3 frames are padded to 208 lines by the SDK,
+// the camera stays open while downstream holds a wrapped frame
+GST_START_TEST (test_zero_copy)
+{
+  GstElement *pipeline = parse_pipeline ("arducamsrc name=src "
+    "num-buffers=10 zero-copy=true max-outstanding-buffers=3 ! "
+    "video/x-raw,format=GRAY8,width=320,height=200,sensor-mode=3 ! "
+    "fakesink name=sink sync=false");
+  TestFrames frames = { 0, };
+
+  frames.size = 320 * 200;
+  test_frames_connect (pipeline, &frames);
+  play_pipeline (pipeline);
+  fail_unless_equals_int (frames.buffers, NUM_BUFFERS);
+  fail_unless_equals_int (frames.copies, 0);
+  fail_unless_equals_int (frames.wrong_size, 0);
+  fail_unless_equals_int (arducam_sim_get_outstanding (0), 1);
+
+  gst_structure_free (stop_pipeline (pipeline));
+  fail_unless_equals_int (arducam_sim_get_outstanding (0), 1);
+  gst_buffer_unref (frames.held);
+  fail_unless_equals_int (arducam_sim_get_outstanding (0), -1);
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Copied frames have the frame size too, whether the
+// buffer comes from the pool or is allocated on a pool miss
+GST_START_TEST (test_copy)
+{
+  GstElement *pipeline = parse_pipeline ("arducamsrc name=src "
+    "num-buffers=10 ! "
+    "video/x-raw,format=GRAY8,width=320,height=200,sensor-mode=3 ! "
+    "fakesink name=sink sync=false");
+  TestFrames frames = { 0, };
+  gdouble bytes_copied = 0;
+
+  frames.size = 320 * 200;
+  test_frames_connect (pipeline, &frames);
+  play_pipeline (pipeline);
+  fail_unless_equals_int (frames.buffers, NUM_BUFFERS);
+  fail_unless_equals_int (frames.copies, NUM_BUFFERS);
+  fail_unless_equals_int (frames.wrong_size, 0);
+  fail_unless_equals_int (arducam_sim_get_outstanding (0), 0);
+
+  GstStructure *stats = stop_pipeline (pipeline);
+  fail_unless (gst_structure_get_double (stats, "bytes-copied-per-frame", 
+    &bytes_copied));
+  fail_unless_equals_float (bytes_copied, 320 * 200);
+  gst_structure_free (stats);
+  gst_buffer_unref (frames.held);
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Metadata of the frames seen by the element named
+// sink, checked against the negotiated caps and against a copy of the buffer
+typedef struct
+{
+  guint buffers;
+  guint missing;
+  guint out_of_order;
+  guint wrong_times;
+  guint wrong_settings;
+  guint not_copied;
+  guint64 sequence;
+}
+TestMeta;
+
+static void
+test_meta_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad, 
+    gpointer data)
+{
+  TestMeta *test = data;
+  GstArduCamMeta *meta = gst_buffer_get_ardu_cam_meta (buffer);
+
+  if (!meta) 
+  {
+    test->missing++;
+    return;
+  }
+  if (test->buffers++ && meta->sequence <= test->sequence) 
+  {
+    test->out_of_order++;
+  }
+  test->sequence = meta->sequence;
+  if (meta->capture_start <= 0 || meta->capture_end < meta->capture_start)
+  {
+    test->wrong_times++;
+  }
+  if (meta->sensor_mode != 3 || meta->fps_n != 30 || meta->fps_d != 1)
+  {
+    test->wrong_settings++;
+  }
+
+  GstBuffer *copy = gst_buffer_copy (buffer);
+  GstArduCamMeta *copied = gst_buffer_get_ardu_cam_meta (copy);
+  if (!copied || copied->sequence != meta->sequence || 
+    copied->capture_start != meta->capture_start || 
+    copied->capture_end != meta->capture_end ||
+    copied->sensor_mode != meta->sensor_mode || 
+    copied->fps_n != meta->fps_n || copied->fps_d != meta->fps_d)
+  {
+    test->not_copied++;
+  }
+  gst_buffer_unref (copy);
+}
+
+GST_START_TEST (test_meta)
+{
+  GstElement *pipeline = parse_pipeline ("arducamsrc name=src "
+    "num-buffers=10 ! "
+    "video/x-raw,format=GRAY8,width=320,height=200,framerate=30/1,"
+    "sensor-mode=3 ! fakesink name=sink sync=false");
+  GstElement *sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  TestMeta test = { 0, };
+
+  g_object_set (sink, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (test_meta_handoff), &test);
+  gst_object_unref (sink);
+  play_pipeline (pipeline);
+  fail_unless_equals_int (test.buffers, NUM_BUFFERS);
+  fail_unless_equals_int (test.missing, 0);
+  fail_unless_equals_int (test.out_of_order, 0);
+  fail_unless_equals_int (test.wrong_times, 0);
+  fail_unless_equals_int (test.wrong_settings, 0);
+  fail_unless_equals_int (test.not_copied, 0);
+
+  gst_structure_free (stop_pipeline (pipeline));
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): The simulated sensor is never triggered, create()
+// stays blocked in the capture call while the properties are set
+GST_START_TEST (test_set_property_latency)
+{
+  GstElement *pipeline, *src;
+  GstQuery *query = gst_query_new_latency ();
+  GstClockTime min = 0, max = 0;
+  gboolean live = FALSE;
+  gint64 slowest = 0;
+
+  g_setenv ("ARDUCAM_SIM_TRIGGER_US", "0", TRUE);
+  pipeline = parse_pipeline ("arducamsrc name=src external-trigger=true "
+    "timeout=500 ! video/x-raw,format=GRAY8,width=640,height=400,"
+    "sensor-mode=2 ! fakesink sync=false");
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  fail_unless_equals_int (gst_element_set_state (pipeline, 
+    GST_STATE_PLAYING), GST_STATE_CHANGE_SUCCESS);
+
+  // NOTE(marcin.sielski): Latency is known once the mode is configured
+  for (gint i = 0; i < 100 && !gst_element_query (src, query); i++)
+  {
+    g_usleep (10000);
+  }
+  gst_query_parse_latency (query, &live, &min, &max);
+  fail_unless (live);
+  fail_unless (min >= GST_SECOND / 210, "Latency %" GST_TIME_FORMAT 
+    " is not in nanoseconds", GST_TIME_ARGS (min));
+  fail_unless (min < GST_SECOND);
+  fail_unless (max >= min);
+  gst_query_unref (query);
+
+  g_usleep (100000);
+  for (gint i = 0; i < 100; i++)
+  {
+    gint64 begin = g_get_monotonic_time ();
+    g_object_set (src, "shutter-speed", 100 + i, "gain", 1 + i % 8, NULL);
+    slowest = MAX (slowest, g_get_monotonic_time () - begin);
+  }
+  fail_unless (slowest < 1000, "Setting properties took %" G_GINT64_FORMAT
+    " us while capturing", slowest);
+
+  fail_unless_equals_int (gst_element_set_state (pipeline, GST_STATE_NULL), 
+    GST_STATE_CHANGE_SUCCESS);
+  gst_object_unref (src);
+  gst_object_unref (pipeline);
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Registers of the simulated sensor are 8 bit wide
+static gint
+read_reg16 (guint16 address)
+{
+  guint16 high = 0, low = 0;
+
+  fail_unless_equals_int (arducam_sim_read_reg (0, address, &high), 0);
+  fail_unless_equals_int (arducam_sim_read_reg (0, address + 1, &low), 0);
+
+  return (high << 8) | low;
+}
+
+GST_START_TEST (test_region_of_interest)
+{
+  GstElement *pipeline = parse_pipeline ("arducamsrc name=src "
+    "num-buffers=10 roi-x=64 roi-y=100 roi-width=640 roi-height=200 ! "
+    "video/x-raw,format=GRAY8,width=640,height=200,framerate=30/1,"
+    "sensor-mode=0 ! fakesink name=sink sync=false");
+  TestFrames frames = { 0, };
+
+  frames.size = 640 * 200;
+  test_frames_connect (pipeline, &frames);
+  play_pipeline (pipeline);
+  fail_unless_equals_int (frames.buffers, NUM_BUFFERS);
+  fail_unless_equals_int (frames.wrong_size, 0);
+
+  // NOTE(marcin.sielski): Window spans the ISP margins on both sides
+  fail_unless_equals_int (read_reg16 (0x3800), 64);
+  fail_unless_equals_int (read_reg16 (0x3802), 100);
+  fail_unless_equals_int (read_reg16 (0x3804), 64 + 640 + 2 * 8 - 1);
+  fail_unless_equals_int (read_reg16 (0x3806), 100 + 200 + 2 * 8 - 1);
+  fail_unless_equals_int (read_reg16 (0x3808), 640);
+  fail_unless_equals_int (read_reg16 (0x380A), 200);
+  // NOTE(marcin.sielski): Mode 0 reads 800 + 110 lines at 60 fps, the frame
+  // length doubles at 30 fps. It is applied before the first capture.
+  fail_unless_equals_int (read_reg16 (0x380E), 2 * (800 + 110));
+
+  gst_structure_free (stop_pipeline (pipeline));
+  gst_buffer_unref (frames.held);
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Mode 5 reads 800 + 110 lines at 480 fps, a region
+// of 64 lines shortens the frame to 64 + 110 lines and runs above 2000 fps
+GST_START_TEST (test_region_of_interest_framerate)
+{
+  GstElement *pipeline = parse_pipeline ("arducamsrc name=src "
+    "num-buffers=10 roi-width=640 roi-height=64 ! "
+    "video/x-raw,format=GRAY8,width=640,height=64,framerate=2000/1,"
+    "sensor-mode=5 ! fakesink name=sink sync=false");
+  GstElement *src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  GstPad *pad = gst_element_get_static_pad (src, "src");
+  GstCaps *filter = gst_caps_from_string ("video/x-raw,format=GRAY8,"
+    "sensor-mode=5");
+  GstCaps *caps = gst_pad_query_caps (pad, filter);
+  TestFrames frames = { 0, };
+
+  fail_if (gst_caps_is_empty (caps));
+  const GValue *framerate = gst_structure_get_value (
+    gst_caps_get_structure (caps, 0), "framerate");
+  fail_unless (GST_VALUE_HOLDS_FRACTION_RANGE (framerate));
+  fail_unless_equals_int (gst_value_get_fraction_numerator (
+    gst_value_get_fraction_range_max (framerate)), 480 * 910 / 174);
+  gst_caps_unref (caps);
+  gst_caps_unref (filter);
+  gst_object_unref (pad);
+  gst_object_unref (src);
+
+  frames.size = 640 * 64;
+  test_frames_connect (pipeline, &frames);
+  play_pipeline (pipeline);
+  fail_unless_equals_int (frames.buffers, NUM_BUFFERS);
+  fail_unless_equals_int (frames.wrong_size, 0);
+  fail_unless_equals_int (read_reg16 (0x380E), (480 * 910 + 1999) / 2000);
+
+  gst_structure_free (stop_pipeline (pipeline));
+  gst_buffer_unref (frames.held);
+}
+GST_END_TEST;
+
+static GstPadProbeReturn
+test_count_gaps (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_GAP)
+  {
+    g_atomic_int_inc ((gint *) data);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+// NOTE(marcin.sielski): The simulated sensor is never triggered, each
+// capture timeout is a gap in the stream rather than a failure
+GST_START_TEST (test_recovery_gap)
+{
+  GstElement *pipeline, *src;
+  GstPad *pad;
+  gint gaps = 0;
+  guint64 counted = 0, recoveries = 0;
+
+  g_setenv ("ARDUCAM_SIM_TRIGGER_US", "0", TRUE);
+  pipeline = parse_pipeline ("arducamsrc name=src external-trigger=true "
+    "timeout=50 ! video/x-raw,format=GRAY8,width=640,height=400,"
+    "sensor-mode=2 ! fakesink sync=false");
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  pad = gst_element_get_static_pad (src, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, 
+    test_count_gaps, &gaps, NULL);
+  fail_if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == 
+    GST_STATE_CHANGE_FAILURE);
+  for (gint i = 0; i < 200 && g_atomic_int_get (&gaps) < 3; i++)
+  {
+    g_usleep (10000);
+  }
+  fail_unless (g_atomic_int_get (&gaps) >= 3, "Only %d GAP events", 
+    g_atomic_int_get (&gaps));
+  gst_object_unref (pad);
+  gst_object_unref (src);
+
+  GstStructure *stats = stop_pipeline (pipeline);
+  fail_unless (gst_structure_get_uint64 (stats, "gaps", &counted));
+  fail_unless (counted >= 3);
+  fail_unless (gst_structure_get_uint64 (stats, "recoveries", &recoveries));
+  fail_unless_equals_uint64 (recoveries, 0);
+  gst_structure_free (stats);
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Every capture times out, the error is posted once
+// the attempts waiting 100, 200 and 400 ms fail
+GST_START_TEST (test_recovery_max_retries)
+{
+  GstElement *pipeline;
+  GstBus *bus;
+  GstMessage *message;
+  guint64 recoveries = 0;
+
+  g_setenv ("ARDUCAM_SIM_TIMEOUT_PERMILLE", "1000", TRUE);
+  pipeline = parse_pipeline ("arducamsrc name=src timeout=50 "
+    "max-retries=3 ! video/x-raw,format=GRAY8,width=640,height=400,"
+    "sensor-mode=2 ! fakesink sync=false");
+  bus = gst_element_get_bus (pipeline);
+  gint64 begin = g_get_monotonic_time ();
+  fail_if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == 
+    GST_STATE_CHANGE_FAILURE);
+  message = gst_bus_timed_pop_filtered (bus, 30 * GST_SECOND, 
+    GST_MESSAGE_EOS | GST_MESSAGE_ERROR | GST_MESSAGE_WARNING);
+  gint64 elapsed = g_get_monotonic_time () - begin;
+  fail_unless (message != NULL);
+  fail_unless_equals_int (GST_MESSAGE_TYPE (message), GST_MESSAGE_ERROR);
+  fail_unless (elapsed >= (100 + 200 + 400) * 1000, "Failed after %" 
+    G_GINT64_FORMAT " us", elapsed);
+  fail_unless (elapsed < 5 * G_USEC_PER_SEC, "Failed after %" 
+    G_GINT64_FORMAT " us", elapsed);
+  gst_message_unref (message);
+  gst_object_unref (bus);
+
+  GstStructure *stats = stop_pipeline (pipeline);
+  fail_unless (gst_structure_get_uint64 (stats, "recoveries", &recoveries));
+  fail_unless_equals_uint64 (recoveries, 0);
+  gst_structure_free (stats);
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): A fifth of the captures time out, each recovery is
+// posted as a warning naming the action taken
+GST_START_TEST (test_recovery_warning)
+{
+  GstElement *pipeline;
+  GstBus *bus;
+  GstMessage *message;
+  guint64 recoveries = 0;
+  guint warnings = 0;
+
+  g_setenv ("ARDUCAM_SIM_TIMEOUT_PERMILLE", "200", TRUE);
+  pipeline = parse_pipeline ("arducamsrc name=src num-buffers=30 timeout=50 "
+    "max-retries=8 ! video/x-raw,format=GRAY8,width=640,height=400,"
+    "sensor-mode=2 ! fakesink sync=false");
+  bus = gst_element_get_bus (pipeline);
+  fail_if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == 
+    GST_STATE_CHANGE_FAILURE);
+  while ((message = gst_bus_timed_pop_filtered (bus, 30 * GST_SECOND, 
+    GST_MESSAGE_EOS | GST_MESSAGE_ERROR | GST_MESSAGE_WARNING)) != NULL &&
+    GST_MESSAGE_TYPE (message) == GST_MESSAGE_WARNING)
+  {
+    GError *error = NULL;
+    gchar *debug = NULL;
+
+    gst_message_parse_warning (message, &error, &debug);
+    fail_unless (g_error_matches (error, GST_RESOURCE_ERROR, 
+      GST_RESOURCE_ERROR_READ));
+    fail_unless (debug != NULL && (g_str_has_prefix (debug, 
+      "Sensor mode reset on attempt ") || g_str_has_prefix (debug, 
+      "Camera reopened on attempt ")), "Unexpected warning %s", debug);
+    warnings++;
+    g_error_free (error);
+    g_free (debug);
+    gst_message_unref (message);
+  }
+  fail_unless (message != NULL);
+  fail_unless_equals_int (GST_MESSAGE_TYPE (message), GST_MESSAGE_EOS);
+  gst_message_unref (message);
+  gst_object_unref (bus);
+  fail_unless (warnings > 0);
+
+  GstStructure *stats = stop_pipeline (pipeline);
+  fail_unless (gst_structure_get_uint64 (stats, "recoveries", &recoveries));
+  fail_unless_equals_uint64 (recoveries, warnings);
+  gst_structure_free (stats);
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Frames before 1 s of running time are late, more 
+// than half of the first 64 frames then halve the sensor frame rate by 
+// doubling the frame length of mode 2 at 100 fps
+GST_START_TEST (test_qos_throttle)
+{
+  GstElement *pipeline, *src;
+  GstBus *bus;
+  GstMessage *message;
+  guint64 skipped = 0, throttles = 0;
+  gdouble sensor_fps = 0.0;
+  GstState state = GST_STATE_NULL;
+
+  pipeline = parse_pipeline ("arducamsrc name=src num-buffers=20 "
+    "qos-throttle=true ! video/x-raw,format=GRAY8,width=640,height=400,"
+    "framerate=100/1,sensor-mode=2 ! fakesink sync=false");
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  bus = gst_element_get_bus (pipeline);
+  fail_if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == 
+    GST_STATE_CHANGE_FAILURE);
+  fail_if (gst_element_get_state (pipeline, &state, NULL, 5 * GST_SECOND) ==
+    GST_STATE_CHANGE_FAILURE);
+  fail_unless_equals_int (state, GST_STATE_PLAYING);
+  fail_unless (gst_element_send_event (src, gst_event_new_qos (
+    GST_QOS_TYPE_UNDERFLOW, 2.0, 250 * GST_MSECOND, 500 * GST_MSECOND)));
+  message = gst_bus_timed_pop_filtered (bus, 30 * GST_SECOND, 
+    GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  fail_unless (message != NULL);
+  fail_unless_equals_int (GST_MESSAGE_TYPE (message), GST_MESSAGE_EOS);
+  gst_message_unref (message);
+  gst_object_unref (bus);
+  gst_object_unref (src);
+  fail_unless_equals_int (read_reg16 (0x380E), 2 * ((210 * 510 + 99) / 100));
+
+  GstStructure *stats = stop_pipeline (pipeline);
+  fail_unless (gst_structure_get_uint64 (stats, "qos-skipped", &skipped));
+  fail_unless (skipped > 64 / 2, "Only %" G_GUINT64_FORMAT " frames skipped",
+    skipped);
+  fail_unless (gst_structure_get_uint64 (stats, "qos-throttles", 
+    &throttles));
+  fail_unless_equals_uint64 (throttles, 1);
+  fail_unless (gst_structure_get_double (stats, "sensor-fps", &sensor_fps));
+  fail_unless (sensor_fps > 49.0 && sensor_fps < 51.0, "Sensor runs at "
+    "%.1f fps", sensor_fps);
+  gst_structure_free (stats);
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Mode 2 captures a frame every 4.8 ms while 
+// downstream takes 20 ms per frame, the ring of 2 frames overflows unless
+// the capture thread blocks
+GST_START_TEST (test_capture_thread_overflow)
+{
+  static const struct
+  {
+    const gchar *policy;
+    gboolean drops;
+  }
+  policies[] = {
+    { "drop-oldest", TRUE },
+    { "drop-newest", TRUE },
+    { "block", FALSE },
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS (policies); i++)
+  {
+    gchar *description = g_strdup_printf ("arducamsrc name=src "
+      "num-buffers=%d capture-thread=true ring-size=2 overflow-policy=%s ! "
+      "video/x-raw,format=GRAY8,width=640,height=400,sensor-mode=2 ! "
+      "identity sleep-time=20000 ! fakesink sync=false", 2 * NUM_BUFFERS, 
+      policies[i].policy);
+    GstElement *pipeline = parse_pipeline (description);
+    GstElement *src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+    guint ring_drops = 0, dropped = 0;
+    guint64 frames = 0;
+
+    play_pipeline (pipeline);
+    g_object_get (src, "ring-drops", &ring_drops, NULL);
+    gst_object_unref (src);
+    GstStructure *stats = stop_pipeline (pipeline);
+
+    GST_INFO ("%s: %" GST_PTR_FORMAT, description, stats);
+    fail_unless (gst_structure_get_uint (stats, "dropped", &dropped));
+    fail_unless_equals_int (dropped, ring_drops);
+    if (policies[i].drops) 
+    {
+      fail_unless (dropped > 0, "No frames dropped with %s", 
+        policies[i].policy);
+    }
+    else fail_unless_equals_int (dropped, 0);
+    fail_unless (gst_structure_get_uint64 (stats, "frames", &frames));
+    fail_unless_equals_uint64 (frames, 2 * NUM_BUFFERS);
+
+    gst_structure_free (stats);
+    g_free (description);
+  }
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Waits for the changes of the properties to be 
+// applied before the next frames
+static void
+wait_writes (GstElement * src, guint64 issued, guint64 suppressed)
+{
+  guint64 current_issued = 0, current_suppressed = 0;
+
+  for (gint i = 0; i < 100; i++)
+  {
+    g_object_get (src, "writes-issued", &current_issued, 
+      "writes-suppressed", &current_suppressed, NULL);
+    if (current_issued == issued && current_suppressed == suppressed) break;
+    g_usleep (10000);
+  }
+  fail_unless_equals_uint64 (current_issued, issued);
+  fail_unless_equals_uint64 (current_suppressed, suppressed);
+}
+
+// NOTE(marcin.sielski): Flip is written when it changes, setting the same
+// value again is suppressed by the shadow of the control
+GST_START_TEST (test_write_suppression)
+{
+  GstElement *pipeline = parse_pipeline ("arducamsrc name=src ! "
+    "video/x-raw,format=GRAY8,width=640,height=400,sensor-mode=2 ! "
+    "fakesink sync=false");
+  GstElement *src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  guint64 issued = 0, suppressed = 0;
+  GstState state = GST_STATE_NULL;
+
+  fail_if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == 
+    GST_STATE_CHANGE_FAILURE);
+  fail_if (gst_element_get_state (pipeline, &state, NULL, 5 * GST_SECOND) ==
+    GST_STATE_CHANGE_FAILURE);
+  fail_unless_equals_int (state, GST_STATE_PLAYING);
+  g_object_get (src, "writes-issued", &issued, 
+    "writes-suppressed", &suppressed, NULL);
+  fail_unless (issued > 0);
+
+  g_object_set (src, "hflip", TRUE, NULL);
+  wait_writes (src, issued + 1, suppressed);
+  g_object_set (src, "hflip", TRUE, NULL);
+  wait_writes (src, issued + 1, suppressed + 1);
+  g_object_set (src, "hflip", FALSE, NULL);
+  wait_writes (src, issued + 2, suppressed + 1);
+
+  gst_object_unref (src);
+  gst_structure_free (stop_pipeline (pipeline));
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Both simulated sensors are triggered by the same 
+// 5 ms pulse, a sensor losing a frame delivers the next one and the older
+// frame of the other sensor is dropped to resynchronize the pair
+GST_START_TEST (test_stereo)
+{
+  static const struct
+  {
+    const gchar *drop_permille;
+    gboolean resyncs;
+  }
+  runs[] = {
+    { "0", FALSE },
+    { "50", TRUE },
+  };
+
+  g_setenv ("ARDUCAM_SIM_TRIGGER_US", "5000", TRUE);
+  for (guint i = 0; i < G_N_ELEMENTS (runs); i++)
+  {
+    GstElement *pipeline;
+    TestFrames frames = { 0, };
+    guint resyncs = 0, dropped = 0;
+    guint64 count = 0;
+
+    g_setenv ("ARDUCAM_SIM_DROP_PERMILLE", runs[i].drop_permille, TRUE);
+    pipeline = parse_pipeline ("arducamsrc name=src num-buffers=50 "
+      "secondary-camera-num=1 external-trigger=true ! "
+      "video/x-raw,format=GRAY8,width=1280,height=400,sensor-mode=2 ! "
+      "fakesink name=sink sync=false");
+    frames.size = 2 * 640 * 400;
+    test_frames_connect (pipeline, &frames);
+    play_pipeline (pipeline);
+    fail_unless_equals_int (frames.buffers, 50);
+    fail_unless_equals_int (frames.wrong_size, 0);
+
+    GstStructure *stats = stop_pipeline (pipeline);
+    GST_INFO ("%s permille dropped: %" GST_PTR_FORMAT, 
+      runs[i].drop_permille, stats);
+    fail_unless (gst_structure_get_uint64 (stats, "frames", &count));
+    fail_unless_equals_uint64 (count, 50);
+    fail_unless (gst_structure_get_uint (stats, "pair-resyncs", &resyncs));
+    if (runs[i].resyncs) fail_unless (resyncs > 0);
+    else fail_unless_equals_int (resyncs, 0);
+    // NOTE(marcin.sielski): Frames dropped to resynchronize are not ring 
+    // drops
+    fail_unless (gst_structure_get_uint (stats, "dropped", &dropped));
+    fail_unless_equals_int (dropped, 0);
+    gst_structure_free (stats);
+    gst_buffer_unref (frames.held);
+  }
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Without a sensor mode in the caps the mode using the
+// least bandwidth at its maximum frame rate is selected. ETM modes compete
+// only with external trigger enabled, the lowest mode wins a tie.
+GST_START_TEST (test_sensor_mode_selection)
+{
+  static const struct
+  {
+    const gchar *caps;
+    gboolean external_trigger;
+    gint mode;
+  }
+  selections[] = {
+    { "video/x-raw,format=GRAY8,width=1280,height=800", FALSE, 0 },
+    { "video/x-raw,format=GRAY8,width=1280,height=800,framerate=100/1", 
+      FALSE, 5 },
+    { "video/x-raw,format=GRAY8,width=640,height=400", FALSE, 2 },
+    { "video/x-raw,format=GRAY8,width=640,height=400,sensor-mode=-1", 
+      FALSE, 2 },
+    { "video/x-raw,format=GRAY8,width=640,height=400", TRUE, 9 },
+    { "video/x-bayer,format=bggr,width=1280,height=800", FALSE, 16 },
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS (selections); i++)
+  {
+    gchar *description = g_strdup_printf ("arducamsrc name=src "
+      "num-buffers=%d external-trigger=%s ! %s ! fakesink sync=false", 
+      NUM_BUFFERS, selections[i].external_trigger ? "true" : "false",
+      selections[i].caps);
+    GstStructure *stats = run_pipeline (description);
+    gint sensor_mode = -1;
+
+    GST_INFO ("%s: %" GST_PTR_FORMAT, description, stats);
+    fail_unless (gst_structure_get_int (stats, "sensor-mode", &sensor_mode));
+    fail_unless_equals_int (sensor_mode, selections[i].mode);
+
+    gst_structure_free (stats);
+    g_free (description);
+  }
+}
+GST_END_TEST;
+
+static Suite *
+arducamsrc_suite (void)
+{
+  Suite *s = suite_create ("arducamsrc");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_sensor_modes);
+  tcase_add_test (tc_chain, test_zero_copy);
+  tcase_add_test (tc_chain, test_copy);
+  tcase_add_test (tc_chain, test_meta);
+  tcase_add_test (tc_chain, test_set_property_latency);
+  tcase_add_test (tc_chain, test_region_of_interest);
+  tcase_add_test (tc_chain, test_region_of_interest_framerate);
+  tcase_add_test (tc_chain, test_recovery_gap);
+  tcase_add_test (tc_chain, test_recovery_max_retries);
+  tcase_add_test (tc_chain, test_recovery_warning);
+  tcase_add_test (tc_chain, test_qos_throttle);
+  tcase_add_test (tc_chain, test_capture_thread_overflow);
+  tcase_add_test (tc_chain, test_write_suppression);
+  tcase_add_test (tc_chain, test_stereo);
+  tcase_add_test (tc_chain, test_sensor_mode_selection);
+
+  return s;
+}
+
+GST_CHECK_MAIN (arducamsrc);
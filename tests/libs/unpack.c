@@ -0,0 +1,251 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "arducamunpack.h"
+
+// NOTE(marcin.sielski): Widths step by one RAW10 group, which covers every
+// tail the vector kernels leave to the scalar code
+#define MAX_WIDTH 1312
+#define GUARD 16
+#define SENTINEL 0xA5A5
+
+typedef void (*UnpackFunc) (const guint8 * src, guint16 * dst, guint width);
+
+// NOTE(marcin.sielski): Packed lines end right before an inaccessible page,
+// a kernel reading past the end of the line faults
+typedef struct
+{
+  guint8 *mapping;
+  gsize size;
+  guint8 *line;
+}
+GuardedLine;
+
+static void
+guarded_line_init (GuardedLine * guarded, gsize length)
+{
+  gsize page = sysconf (_SC_PAGESIZE);
+
+  guarded->size = (length + page - 1) / page * page + page;
+  guarded->mapping = mmap (NULL, guarded->size, PROT_READ | PROT_WRITE, 
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  fail_unless (guarded->mapping != MAP_FAILED);
+  fail_unless (mprotect (guarded->mapping + guarded->size - page, page, 
+    PROT_NONE) == 0);
+  guarded->line = guarded->mapping + guarded->size - page - length;
+}
+
+static void
+guarded_line_clear (GuardedLine * guarded)
+{
+  munmap (guarded->mapping, guarded->size);
+}
+
+static void
+fill_random (GRand * rand, guint8 * data, gsize length)
+{
+  for (gsize i = 0; i < length; i++) data[i] = g_rand_int (rand);
+}
+
+static guint16
+reference_sample (const guint8 * line, guint x)
+{
+  const guint8 *group = line + x / 4 * 5;
+
+  return (group[x % 4] << 2) | ((group[4] >> (2 * (x % 4))) & 0x3);
+}
+
+// NOTE(marcin.sielski): Unpacks the line and checks nothing is written past
+// the end of the output
+static void
+unpack_line (UnpackFunc unpack, const guint8 * line, guint16 * dst, 
+    guint width)
+{
+  for (guint x = 0; x < width + GUARD; x++) dst[x] = SENTINEL;
+  unpack (line, dst, width);
+  for (guint x = width; x < width + GUARD; x++)
+  {
+    fail_unless_equals_int (dst[x], SENTINEL);
+  }
+}
+
+static void
+check_scalar (UnpackFunc unpack, guint shift)
+{
+  GRand *rand = g_rand_new_with_seed (1);
+  guint16 dst[MAX_WIDTH + GUARD];
+
+  fail_unless (arducam_unpack_set_implementation ("scalar"));
+  for (guint width = 4; width <= MAX_WIDTH; width += 4)
+  {
+    GuardedLine guarded;
+
+    guarded_line_init (&guarded, ARDUCAM_RAW10_LINE_SIZE (width));
+    fill_random (rand, guarded.line, ARDUCAM_RAW10_LINE_SIZE (width));
+    unpack_line (unpack, guarded.line, dst, width);
+    for (guint x = 0; x < width; x++)
+    {
+      fail_unless_equals_int (GUINT16_FROM_LE (dst[x]), 
+        reference_sample (guarded.line, x) << shift);
+    }
+    guarded_line_clear (&guarded);
+  }
+  g_rand_free (rand);
+}
+
+// NOTE(marcin.sielski): Every kernel usable on this CPU has to produce the
+// same samples as the scalar code
+static void
+check_kernels (UnpackFunc unpack)
+{
+  const gchar **implementations = arducam_unpack_implementations ();
+  GRand *rand = g_rand_new_with_seed (1);
+  guint16 expected[MAX_WIDTH + GUARD];
+  guint16 dst[MAX_WIDTH + GUARD];
+
+  for (guint width = 4; width <= MAX_WIDTH; width += 4)
+  {
+    GuardedLine guarded;
+
+    guarded_line_init (&guarded, ARDUCAM_RAW10_LINE_SIZE (width));
+    fill_random (rand, guarded.line, ARDUCAM_RAW10_LINE_SIZE (width));
+    fail_unless (arducam_unpack_set_implementation ("scalar"));
+    unpack_line (unpack, guarded.line, expected, width);
+    for (guint i = 0; implementations[i]; i++)
+    {
+      fail_unless (arducam_unpack_set_implementation (implementations[i]));
+      unpack_line (unpack, guarded.line, dst, width);
+      for (guint x = 0; x < width; x++)
+      {
+        fail_unless (dst[x] == expected[x], "%s differs from scalar at %u "
+          "of %u: %u != %u", implementations[i], x, width, dst[x], 
+          expected[x]);
+      }
+    }
+    guarded_line_clear (&guarded);
+  }
+  g_rand_free (rand);
+}
+
+GST_START_TEST (test_implementations)
+{
+  const gchar **implementations = arducam_unpack_implementations ();
+  guint n = g_strv_length ((gchar **) implementations);
+
+  fail_unless (n > 0);
+  fail_unless_equals_string (implementations[n - 1], "scalar");
+  fail_if (arducam_unpack_set_implementation ("none"));
+  for (guint i = 0; i < n; i++)
+  {
+    fail_unless (arducam_unpack_set_implementation (implementations[i]));
+    fail_unless_equals_string (arducam_unpack_implementation (), 
+      implementations[i]);
+  }
+}
+GST_END_TEST;
+
+GST_START_TEST (test_gray16_scalar)
+{
+  check_scalar (arducam_unpack_raw10_to_gray16, 6);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_bayer16_scalar)
+{
+  check_scalar (arducam_unpack_raw10_to_bayer16, 0);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_gray16_kernels)
+{
+  check_kernels (arducam_unpack_raw10_to_gray16);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_bayer16_kernels)
+{
+  check_kernels (arducam_unpack_raw10_to_bayer16);
+}
+GST_END_TEST;
+
+// NOTE(marcin.sielski): Three samples per word, the last word of a line
+// holds the remaining one or two
+GST_START_TEST (test_gray10_le32)
+{
+  GRand *rand = g_rand_new_with_seed (1);
+  guint32 dst[MAX_WIDTH / 3 + 1 + GUARD];
+
+  for (guint width = 4; width <= MAX_WIDTH; width += 4)
+  {
+    guint words = (width + 2) / 3;
+    GuardedLine guarded;
+
+    guarded_line_init (&guarded, ARDUCAM_RAW10_LINE_SIZE (width));
+    fill_random (rand, guarded.line, ARDUCAM_RAW10_LINE_SIZE (width));
+    for (guint i = 0; i < words + GUARD; i++) dst[i] = SENTINEL;
+    arducam_unpack_raw10_to_gray10_le32 (guarded.line, dst, width);
+    for (guint x = 0; x < width; x++)
+    {
+      fail_unless_equals_int ((GUINT32_FROM_LE (dst[x / 3]) >> 
+        (10 * (x % 3))) & 0x3FF, reference_sample (guarded.line, x));
+    }
+    for (guint i = 0; i < words; i++)
+    {
+      fail_unless_equals_int (GUINT32_FROM_LE (dst[i]) >> 30, 0);
+    }
+    for (guint i = words; i < words + GUARD; i++)
+    {
+      fail_unless_equals_int (dst[i], SENTINEL);
+    }
+    guarded_line_clear (&guarded);
+  }
+  g_rand_free (rand);
+}
+GST_END_TEST;
+
+static Suite *
+unpack_suite (void)
+{
+  Suite *s = suite_create ("unpack");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_implementations);
+  tcase_add_test (tc_chain, test_gray16_scalar);
+  tcase_add_test (tc_chain, test_bayer16_scalar);
+  tcase_add_test (tc_chain, test_gray16_kernels);
+  tcase_add_test (tc_chain, test_bayer16_kernels);
+  tcase_add_test (tc_chain, test_gray10_le32);
+
+  return s;
+}
+
+GST_CHECK_MAIN (unpack);
@@ -0,0 +1,69 @@
+/*
+* MIT License
+*
+* Copyright (c) 2021 Marcin Sielski <marcin.sielski@gmail.com>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#ifndef __ARDUCAM_TEST_MODES_H__
+#define __ARDUCAM_TEST_MODES_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// NOTE(marcin.sielski): Sensor modes of the OV9281 with the caps delivering
+// their samples without conversion, ETM modes are read out on external
+// trigger only
+static const struct
+{
+  gint mode;
+  const gchar *caps;
+  gboolean etm;
+}
+test_modes[] = {
+  { 0, "video/x-raw,format=GRAY8,width=1280,height=800", FALSE },
+  { 1, "video/x-raw,format=GRAY8,width=1280,height=720", FALSE },
+  { 2, "video/x-raw,format=GRAY8,width=640,height=400", FALSE },
+  { 3, "video/x-raw,format=GRAY8,width=320,height=200", FALSE },
+  { 4, "video/x-raw,format=GRAY8,width=160,height=100", FALSE },
+  { 5, "video/x-raw,format=GRAY8,width=1280,height=800", FALSE },
+  { 6, "video/x-y10p,width=1280,height=800", FALSE },
+  { 7, "video/x-raw,format=GRAY8,width=1280,height=800", TRUE },
+  { 8, "video/x-raw,format=GRAY8,width=1280,height=720", TRUE },
+  { 9, "video/x-raw,format=GRAY8,width=640,height=400", TRUE },
+  { 10, "video/x-raw,format=GRAY8,width=320,height=200", TRUE },
+  { 11, "video/x-raw,format=GRAY8,width=1280,height=800", TRUE },
+  { 12, "video/x-y10p,width=1280,height=800", TRUE },
+  { 13, "video/x-raw,format=GRAY8,width=1280,height=720", TRUE },
+  { 14, "video/x-raw,format=GRAY8,width=640,height=400", TRUE },
+  { 15, "video/x-raw,format=GRAY8,width=320,height=200", TRUE },
+  { 16, "video/x-bayer,format=bggr,width=1280,height=800", FALSE },
+  { 17, "video/x-bayer,format=bggr,width=1280,height=720", FALSE },
+  { 18, "video/x-bayer,format=bggr,width=640,height=400", FALSE },
+  { 19, "video/x-bayer,format=bggr,width=320,height=200", FALSE },
+  { 20, "video/x-bayer,format=bggr,width=160,height=100", FALSE },
+  { 21, "video/x-bayer,format=bggr,width=1280,height=800", FALSE },
+  { 22, "video/x-bayer,format=bggr10le,width=1280,height=800", FALSE },
+};
+
+G_END_DECLS
+
+#endif /* __ARDUCAM_TEST_MODES_H__ */